@@ -0,0 +1,113 @@
+/*
+ * Contention microbenchmark for the frontier hand-off queue.
+ *
+ * Half the threads push and half pop a fixed number of items through one
+ * queue, comparing mpmc_queue one item at a time, mpmc_queue in batches
+ * and a mutex-guarded std::deque. Prints million items per second.
+ *
+ *   cmake -DCRAWL_BUILD_BENCH=ON ... && ./queue_bench [items]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mpmc_queue.hpp"
+
+const size_t batch = 32;
+
+struct locked_queue {
+  std::mutex mutex;
+  std::deque<size_t> items;
+
+  size_t push_batch(const size_t *values, size_t n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    items.insert(items.end(), values, values + n);
+    return n;
+  }
+
+  size_t pop_batch(size_t *out, size_t n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t k = 0;
+    for (; k < n && !items.empty(); k++) {
+      out[k] = items.front();
+      items.pop_front();
+    }
+    return k;
+  }
+};
+
+/* million items per second through q with the given threads and batch size */
+template <typename Q> double run(Q &q, int threads, size_t items, size_t n) {
+  int producers = std::max(1, threads / 2);
+  int consumers = std::max(1, threads - producers);
+  size_t per_producer = items / producers;
+  size_t total = per_producer * producers;
+  std::vector<std::thread> workers;
+  std::vector<size_t> sums(consumers);
+  std::atomic<size_t> popped(0);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int p = 0; p < producers; p++)
+    workers.emplace_back([&q, per_producer, n] {
+      size_t values[batch];
+      for (size_t i = 0; i < per_producer;) {
+        size_t k = std::min(n, per_producer - i);
+        for (size_t j = 0; j < k; j++)
+          values[j] = i + j;
+        size_t done = 0;
+        while (done < k) {
+          size_t pushed = q.push_batch(values + done, k - done);
+          if (!pushed)
+            std::this_thread::yield();
+          done += pushed;
+        }
+        i += k;
+      }
+    });
+  for (int c = 0; c < consumers; c++)
+    workers.emplace_back([&q, &popped, &sums, c, total, n] {
+      size_t values[batch];
+      while (popped.load(std::memory_order_relaxed) < total) {
+        size_t k = q.pop_batch(values, n);
+        if (!k) {
+          std::this_thread::yield();
+          continue;
+        }
+        for (size_t j = 0; j < k; j++)
+          sums[c] += values[j];
+        popped += k;
+      }
+    });
+  for (auto &w : workers)
+    w.join();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  /* every item must come out exactly once */
+  size_t sum = 0;
+  for (size_t s : sums)
+    sum += s;
+  if (sum != producers * (per_producer * (per_producer - 1) / 2)) {
+    fprintf(stderr, "lost or duplicated items with %d threads\n", threads);
+    std::exit(EXIT_FAILURE);
+  }
+  return total / elapsed.count() / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+  size_t items = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+  printf("%8s %12s %12s %12s\n", "threads", "mpmc", "mpmc/32", "mutex/32");
+  for (int threads = 2; threads <= 64; threads *= 2) {
+    mpmc_queue<size_t> single(4096), batched(4096);
+    locked_queue locked;
+    printf("%8d %12.2f %12.2f %12.2f\n", threads, run(single, threads, items, 1),
+           run(batched, threads, items, batch), run(locked, threads, items, batch));
+  }
+  return 0;
+}
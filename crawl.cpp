@@ -21,173 +21,291 @@
  *
  */
 
-#include <cmath>
+#include <algorithm>
+#include <cerrno>
 #include <csignal>
 
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <fstream>
+#include <map>
 #include <stdexcept>
 #include <string>
 #include <vector>
 #include <chrono>
+#include <sstream>
 
-#include <curl/curl.h>
-#include <libxml/HTMLparser.h>
-#include <libxml/uri.h>
-#include <libxml/xpath.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-#include "ngraph.hpp"
-
-#define crawler_version "0.0.1"
+#include "crawler.hpp"
+#include "shard.hpp"
 
 using std::string;
 
-/* Parameters and flags */
-int max_con = 200;
-int max_total = 20000;
-int max_requests = 500;
-size_t max_link_per_page = 20;
-int follow_relative_links = 1;
-
-const char *useragent =
-    "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 "
-    "(KHTML, like Gecko) Chrome/88.0.4292.0 Safari/537.36";
-
-char *start_url = nullptr;
-
-/* Network graph structure */
-NGraph::tGraph<string> network;
+/* The crawler in use, for the signal handler */
+crawler *running = nullptr;
+volatile sig_atomic_t stop_requested = 0;
 
 /* Signal handlers */
-int pending_interrupt = 0;
 void sighandler(int dummy) {
   (void)dummy;
-  pending_interrupt = 1;
+  stop_requested = 1;
+  if (running)
+    running->interrupt();
 }
 
-//
-//  libcurl write callback function
-//
-static int writer(char *data, size_t size, size_t nmemb, string *writerData) {
-  if (!writerData)
-    return 0;
-  writerData->append(data, size * nmemb);
-  return size * nmemb;
-}
+void print_message(const string &message) { printf("%s\n", message.c_str()); }
 
-CURL *make_handle(char *url) {
-  CURL *handle = curl_easy_init();
-
-  /* Important: use HTTP2 over HTTPS */
-  curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
-  curl_easy_setopt(handle, CURLOPT_URL, url);
-
-  /* buffer body */
-  string *buffer = new string;
-
-  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writer);
-  curl_easy_setopt(handle, CURLOPT_WRITEDATA, buffer);
-  curl_easy_setopt(handle, CURLOPT_PRIVATE, buffer);
-
-  /* For completeness */
-  curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
-  curl_easy_setopt(handle, CURLOPT_TIMEOUT, 5L);
-  curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(handle, CURLOPT_MAXREDIRS, 3L);
-  curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, 2L);
-  curl_easy_setopt(handle, CURLOPT_COOKIEFILE, "");
-  curl_easy_setopt(handle, CURLOPT_FILETIME, 1L);
-  curl_easy_setopt(handle, CURLOPT_USERAGENT, useragent);
-  curl_easy_setopt(handle, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
-  curl_easy_setopt(handle, CURLOPT_UNRESTRICTED_AUTH, 1L);
-  curl_easy_setopt(handle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
-  curl_easy_setopt(handle, CURLOPT_EXPECT_100_TIMEOUT_MS, 0L);
-
-  return handle;
-}
+void print_broken(const std::vector<std::tuple<int, string> > &broken_links,
+                  int complete, const NGraph::tGraph<string> &network) {
+  if (int n_broken = broken_links.size()) {
+    printf("\nSummary: %d/%d links are broken.\n", n_broken, complete);
 
-/* HREF finder implemented in libxml2 but could be any HTML parser */
-size_t follow_links(CURLM *multi_handle, string *mem, char *url) {
-  // Only follow links from the start domain
-  // TODO: This only allows link following if the url
-  // begins with the start_url, so we start with
-  // https://www.example.com/foo we won't follow
-  // links from https://www.example.com/bar
-  if (strncmp(url, start_url, strlen(start_url))) {
-    return 0;
-  }
-
-  int opts = HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING |
-             HTML_PARSE_NONET;
-  htmlDocPtr doc = htmlReadMemory(mem->c_str(), mem->size(), url, NULL, opts);
-  if (!doc)
-    return 0;
-  xmlChar *xpath = (xmlChar *)"//a/@href";
-  xmlXPathContextPtr context = xmlXPathNewContext(doc);
-  xmlXPathObjectPtr result = xmlXPathEvalExpression(xpath, context);
-  xmlXPathFreeContext(context);
-  if (!result)
-    return 0;
-  xmlNodeSetPtr nodeset = result->nodesetval;
-  if (xmlXPathNodeSetIsEmpty(nodeset)) {
-    xmlXPathFreeObject(result);
-    return 0;
-  }
-
-  size_t count = 0;
-  xmlURIPtr uri = xmlCreateURI();
-  for (int i = 0; i < nodeset->nodeNr; i++) {
-    const xmlNode *node = nodeset->nodeTab[i]->xmlChildrenNode;
-    xmlChar *href = xmlNodeListGetString(doc, node, 1);
-    if (follow_relative_links) {
-      xmlChar *orig = href;
-      href = xmlBuildURI(href, (xmlChar *)url);
-      xmlFree(orig);
+    for (const auto &url : broken_links) {
+      printf("  HTTP %d: %s\n", std::get<0>(url), std::get<1>(url).c_str());
     }
-    // remove fragment
-    xmlParseURIReference(uri, (const char *)href);
-    xmlFree(uri->fragment);
-    uri->fragment = nullptr;
-    char *link = (char *)xmlSaveUri(uri);
-    if (!link || strlen(link) < 20)
-      continue;
-    if (!strncmp(link, "http://", 7) || !strncmp(link, "https://", 8)) {
+  } else {
+    printf("\nSummary: checked %d links, no broken links found.\n", network.num_nodes());
+  }
+}
 
-      // If link has been visited already, skip adding to queue
-      if (network.find(link) != network.end()) {
-        network.insert_edge(url, link);
+bool write_graphviz(const NGraph::tGraph<string> &network,
+                    const char *graphviz_fname) {
+  FILE *fptr = std::fopen(graphviz_fname, "w");
+  if (fptr) {
+    network.to_graphviz(fptr);
+    printf("Wrote GraphViz output to %s\n", graphviz_fname);
+    fclose(fptr);
+    return true;
+  }
+  fprintf(stderr, "Failed to write graphviz output to %s\n",
+          graphviz_fname == nullptr ? "out.gv" : graphviz_fname);
+  return false;
+}
+
+/*
+ * The parent's side of sharding, see crawler.cpp for the protocol: route
+ * links between the shards until all of them are idle with every routed
+ * link delivered, then stop them and merge their results into `network`
+ * and broken_links. Shards may take on max_total links between them.
+ */
+struct shard_peer {
+  pid_t pid;
+  int fd;
+  string in, out;
+  int forwarded; /* links routed to this shard */
+  int idle_at;   /* links it had received when it last reported idle */
+  int load;      /* links it has taken on */
+  bool idle;
+  bool open;
+};
+
+int run_router(std::vector<shard_peer> &peers, int max_total,
+               NGraph::tGraph<string> &network,
+               std::vector<std::tuple<int, string> > &broken_links) {
+  int complete = 0;
+  int routed = 0;
+  bool full = false;
+  bool stopping = false;
+  for (;;) {
+    std::vector<struct pollfd> fds;
+    for (const auto &p : peers)
+      fds.push_back({p.open ? p.fd : -1,
+                     (short)(POLLIN | (p.out.empty() ? 0 : POLLOUT)), 0});
+    if (std::none_of(peers.begin(), peers.end(),
+                     [](const shard_peer &p) { return p.open; }))
+      break;
+    if (poll(fds.data(), fds.size(), -1) < 0)
+      continue; /* interrupted, the shards got the signal too */
+
+    for (size_t i = 0; i < peers.size(); i++) {
+      shard_peer &p = peers[i];
+      if (!p.open)
+        continue;
+      if (fds[i].revents & POLLOUT) {
+        ssize_t n = write(p.fd, p.out.data(), p.out.size());
+        if (n > 0)
+          p.out.erase(0, n);
+      }
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      char buf[16384];
+      ssize_t n = read(p.fd, buf, sizeof buf);
+      if (n <= 0 && !(n < 0 && (errno == EAGAIN || errno == EINTR))) {
+        close(p.fd);
+        p.open = false;
         continue;
       }
-      network.insert_edge(url, link);
+      if (n > 0)
+        p.in.append(buf, n);
+
+      size_t eol;
+      while ((eol = p.in.find('\n')) != string::npos) {
+        std::istringstream line(p.in.substr(0, eol));
+        p.in.erase(0, eol + 1);
+        string key, a, b;
+        line >> key >> a >> b;
+        if (key == "url") {
+          shard_peer &owner = peers[shard_of(a, peers.size())];
+          if (owner.open) {
+            owner.out += "url " + a + "\n";
+            owner.forwarded++;
+            routed++;
+          }
+          p.idle = false;
+        } else if (key == "idle") {
+          p.idle = true;
+          p.idle_at = std::stoi(a);
+        } else if (key == "load") {
+          p.load = std::stoi(a);
+        } else if (key == "complete") {
+          complete += std::stoi(a);
+        } else if (key == "broken") {
+          broken_links.push_back({std::stoi(a), b});
+        } else if (key == "edge") {
+          network.insert_edge(a, b);
+        } else if (key == "node") {
+          network.insert_vertex(a);
+        }
+      }
+    }
 
-      curl_multi_add_handle(multi_handle, make_handle(link));
-      if (count++ == max_link_per_page)
-        break;
+    int load = 0;
+    for (const auto &p : peers)
+      load += p.load;
+    if (!full && load >= max_total) {
+      full = true;
+      for (auto &p : peers)
+        p.out += "full\n";
+    }
+
+    /* nothing in flight anywhere: every shard idle, every link delivered */
+    if (!stopping &&
+        std::all_of(peers.begin(), peers.end(), [](const shard_peer &p) {
+          return !p.open || (p.idle && p.idle_at == p.forwarded && p.out.empty());
+        })) {
+      stopping = true;
+      for (auto &p : peers)
+        p.out += "stop\n";
     }
-    xmlFree(link);
   }
-  xmlXPathFreeObject(result);
-  xmlFreeURI(uri);
-  return count;
+
+  for (const auto &p : peers)
+    waitpid(p.pid, nullptr, 0);
+  printf("Shards: %zu processes, %d links routed between them.\n", peers.size(),
+         routed);
+  return complete;
 }
 
-int is_html(char *ctype) {
-  return ctype != NULL && strlen(ctype) > 10 && strstr(ctype, "text/html");
+/*
+ * Fork the shards. Returns in each shard, with its share of the rate and
+ * bandwidth limits and its own cache files; the parent routes, prints the
+ * merged summary and exits. A single-site crawl runs on one shard, so it
+ * keeps the whole link, request and connection budgets, and the parent
+ * holds all shards to max_total together.
+ */
+void fork_shards(int n_shards, crawler_config &engine, crawl_config &job,
+                 const char *graphviz_fname) {
+  std::vector<shard_peer> peers;
+  fflush(stdout);
+  for (int i = 0; i < n_shards; i++) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+      perror("socketpair");
+      std::exit(EXIT_FAILURE);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      std::exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      for (const auto &p : peers)
+        close(p.fd);
+      close(sv[0]);
+      crawl_as_shard(n_shards, i, sv[1]);
+      fcntl(sv[1], F_SETFL, O_NONBLOCK);
+      engine.max_rate /= n_shards;
+      engine.max_bandwidth /= n_shards;
+      /* page and DNS caches are rewritten whole, give each shard its own */
+      string suffix = std::to_string(i);
+      if (!engine.cache.empty())
+        engine.cache.append(".").append(suffix);
+      if (!engine.dns_cache.empty())
+        engine.dns_cache.append(".").append(suffix);
+      return;
+    }
+    close(sv[1]);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    peers.push_back({pid, sv[0], string(), string(), 0, -1, 0, false, true});
+  }
+
+  std::signal(SIGINT, sighandler);
+  printf("Starting %d crawler shards at %s . . .\n", n_shards,
+         job.start_url.c_str());
+  NGraph::tGraph<string> network;
+  std::vector<std::tuple<int, string> > broken_links;
+  int complete = run_router(peers, job.max_total, network, broken_links);
+  print_broken(broken_links, complete, network);
+  if (!write_graphviz(network, graphviz_fname))
+    std::exit(EXIT_FAILURE);
+  std::exit(broken_links.size() ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 void print_usage(char *pname) {
+  crawler_config engine;
+  crawl_config job;
   fprintf(stderr, "Usage: %s [options...] <url>\n\
     -h                       Print this help text and exit\n\
     -v                       Verbose\n\
     -V, --version            Print version and exit\n\
     -c, --max-con <int>      Max # of simultaneously open connections in total (default %d)\n\
     -t, --max-total <int>    Max # of requests total (default %d)\n\
-    -r, --max-requests <int> Max # of pending requests (default %d)\n\
+    -r, --max-requests <int> Max # of pending requests, shared by all crawls with --jobs or --daemon (default %d)\n\
     -m, --max-link-per-page  Max # of links to follow per page (default %zu)\n\
-    -o, ---output <filename> Filename to write graphviz compatible network graph\n\
+    --max-depth <int>        Max # of links between the start page and pages to follow, 0 = no limit (default 0)\n\
+    -o, --output <filename>  Filename to write graphviz compatible network graph\n\
+    -d, --deadline <sec>     Stop admitting new URLs in time to finish within <sec> seconds\n\
+    --crawl-con <int>        Max # of in-scope page fetches in flight (default: rest of -r)\n\
+    --crawl-rate <float>     Max in-scope page fetches per second (default unlimited)\n\
+    --external-con <int>     Max # of off-site link checks in flight (default: min(-c, -r)/4)\n\
+    --external-rate <float>  Max off-site link checks per second (default unlimited)\n\
+    --retry-con <int>        Max # of retries in flight (default: -r/10)\n\
+    --retry-rate <float>     Max retries per second (default unlimited)\n\
+    --max-retries <int>      Max # of retries per URL (default %d)\n\
+    --retry-budget <int>     Max # of retries in total (default: -t/10)\n\
+    --max-rate <float>       Max requests per second in total (default unlimited)\n\
+    --max-bandwidth <float>  Max download bandwidth in Mbit/s in total (default unlimited)\n\
+    --timeout-factor <float> Per-host timeouts are p99 latency times this, 0 = fixed 5s (default %g)\n\
+    --rewrite-after <int>    Rewrite URLs after this many consistent host-wide redirects, 0 = never (default 3)\n\
+    --trap-threshold <int>   Max # of URLs per host URL pattern, 0 = no limit (default 0)\n\
+    --checkpoint <dir>       Periodically and on Ctrl-C save crawl state to <dir>\n\
+    --checkpoint-interval <sec>  Seconds between checkpoints (default %g)\n\
+    --resume <dir>           Continue the crawl saved in <dir> (<url> may be omitted)\n\
+    --cache <filename>       Revalidate pages cached in <filename> and reuse their links if unchanged\n\
+    --revisit-budget <int>   With --cache, refetch only the <int> cached pages most likely to have changed (default: all)\n\
+    --status-cache <filename>  Share off-site link statuses between runs through <filename>\n\
+    --status-ttl <sec>       Reuse cached off-site link statuses up to <sec> old (default 86400)\n\
+    --dns-threads <int>      # of threads resolving discovered hosts ahead of time, 0 = off (default %d)\n\
+    --dns-cache <filename>   Keep resolved addresses in <filename> for warm starts\n\
+    --dns-ttl <sec>          Reuse cached addresses up to <sec> old (default 3600)\n\
+    --parsers <int>          # of threads parsing pages, 0 = parse on the network thread (default %d)\n\
+    --shards <int>           Split the crawl by host over this many processes (default 1)\n\
+    --shared-seen <filename> Skip off-site links already checked by crawls sharing <filename>, use with --status-cache\n\
+    --sitemap                Also queue the pages listed in the sitemaps of robots.txt or /sitemap.xml\n\
+    --jobs <filename>        Run the crawls in <filename> side by side, one per line as [options...] <url>\n\
+    --daemon <socket>        Keep running and serve the crawls clients request over the Unix socket <socket>\n\
+    --connect <socket> [options...] <url>  Have the daemon at <socket> run this crawl and print its results\n\
 ",
-          pname, max_con, max_total, max_requests, max_link_per_page);
+          pname, engine.max_con, job.max_total, job.max_requests,
+          job.max_link_per_page, job.max_retries, engine.timeout_factor,
+          job.checkpoint_interval, engine.dns_threads, engine.parsers);
 }
 
 void print_version(char *pname) {
@@ -199,6 +317,417 @@ bool has_flag(const char *arg, const char *name1, const char *name2 = "") {
          (strlen(name2) && !strncmp(arg, name2, strlen(name2)));
 }
 
+/* flags of one crawl, also accepted in job lines; false if arg is not one */
+bool parse_job_flag(char **argv, int &i, crawl_config &job,
+                    const char *&graphviz_fname) {
+  if (has_flag(argv[i], "-t", "--max-total")) {
+    job.max_total = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "-r", "--max-requests")) {
+    job.max_requests = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "-m", "--max-link-per-page")) {
+    job.max_link_per_page = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--max-depth")) {
+    job.max_depth = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--revisit-budget")) {
+    job.revisit_budget = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "-o", "--output")) {
+    graphviz_fname = argv[++i];
+  } else if (has_flag(argv[i], "-d", "--deadline")) {
+    job.deadline = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--crawl-con")) {
+    job.crawl_con = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--crawl-rate")) {
+    job.crawl_rate = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--external-con")) {
+    job.external_con = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--external-rate")) {
+    job.external_rate = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--retry-con")) {
+    job.retry_con = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--retry-rate")) {
+    job.retry_rate = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--max-retries")) {
+    job.max_retries = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--retry-budget")) {
+    job.retry_budget = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--rewrite-after")) {
+    job.rewrite_after = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--trap-threshold")) {
+    job.trap_threshold = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--checkpoint-interval")) {
+    job.checkpoint_interval = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--checkpoint")) {
+    job.checkpoint_dir = argv[++i];
+  } else if (has_flag(argv[i], "--resume")) {
+    job.resume_dir = argv[++i];
+  } else if (has_flag(argv[i], "--sitemap")) {
+    job.sitemap = true;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/* flags of the engine, fixed for all crawls of a daemon */
+bool parse_engine_flag(char **argv, int &i, crawler_config &engine) {
+  if (has_flag(argv[i], "-c", "--max-con")) {
+    engine.max_con = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--max-rate")) {
+    engine.max_rate = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--max-bandwidth")) {
+    engine.max_bandwidth = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--timeout-factor")) {
+    engine.timeout_factor = std::stod(argv[++i]);
+  } else if (has_flag(argv[i], "--cache")) {
+    engine.cache = argv[++i];
+  } else if (has_flag(argv[i], "--status-cache")) {
+    engine.status_cache = argv[++i];
+  } else if (has_flag(argv[i], "--status-ttl")) {
+    engine.status_ttl = std::stol(argv[++i]);
+  } else if (has_flag(argv[i], "--shared-seen")) {
+    engine.shared_seen = argv[++i];
+  } else if (has_flag(argv[i], "--parsers")) {
+    engine.parsers = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--dns-threads")) {
+    engine.dns_threads = std::stoi(argv[++i]);
+  } else if (has_flag(argv[i], "--dns-cache")) {
+    engine.dns_cache = argv[++i];
+  } else if (has_flag(argv[i], "--dns-ttl")) {
+    engine.dns_ttl = std::stol(argv[++i]);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*
+ * A crawl given as one line of flags and URL, as on the command line, for
+ * --jobs files and daemon clients. Engine flags such as -c apply to all
+ * crawls and are rejected. Returns an error message, or "" if the line is
+ * a crawl.
+ */
+string parse_job_line(const string &line, crawl_config &job,
+                      string &graphviz_fname) {
+  std::vector<string> args;
+  std::istringstream words(line);
+  for (string w; words >> w;)
+    args.push_back(w);
+  std::vector<char *> argv;
+  for (auto &a : args)
+    argv.push_back(&a[0]);
+  argv.push_back(nullptr);
+
+  crawler_config engine;
+  const char *fname = nullptr;
+  int i = 0;
+  try {
+    for (i = 0; i < (int)args.size(); i++) {
+      int first = i;
+      if (parse_job_flag(argv.data(), i, job, fname))
+        continue;
+      if (parse_engine_flag(argv.data(), i, engine))
+        return args[first] + " applies to all crawls";
+      if (i == (int)args.size() - 1 && args[i][0] != '-')
+        job.start_url = args[i];
+      else
+        return "unknown flag " + args[i];
+    }
+  } catch (std::logic_error &err) {
+    return "invalid argument to " + args[std::max(0, i - 1)];
+  }
+  if (fname)
+    graphviz_fname = fname;
+  return "";
+}
+
+void print_job(int id, const crawl_result &r) {
+  int n_suppressed = 0;
+  for (const auto &p : r.suppressed)
+    n_suppressed += p.second;
+  printf("Job %d: %s, %zu/%d links are broken, %.3fs.\n", id,
+         r.start_url.c_str(), r.broken_links.size(), r.complete, r.elapsed);
+  if (n_suppressed)
+    printf("  %d links suppressed as crawler traps\n", n_suppressed);
+}
+
+/*
+ * `crawl --jobs <file>` runs the crawls listed in file at the same time,
+ * on one crawler. Flags given on the command line are defaults for every
+ * line; each line has its own URL and, with -o, its own graph.
+ */
+int run_jobs(const crawler_config &engine, const crawl_config &defaults,
+             const char *fname) {
+  std::ifstream in(fname);
+  if (!in) {
+    fprintf(stderr, "Cannot read %s\n", fname);
+    return EXIT_FAILURE;
+  }
+  std::vector<crawl_config> jobs;
+  std::vector<string> graphs;
+  int n = 0;
+  for (string line; std::getline(in, line);) {
+    n++;
+    if (line.find_first_not_of(" \t\r") == string::npos || line[0] == '#')
+      continue;
+    crawl_config job = defaults;
+    job.start_url.clear();
+    string graphviz_fname;
+    string error = parse_job_line(line, job, graphviz_fname);
+    if (error.empty() && job.start_url.empty() && job.resume_dir.empty())
+      error = "no URL specified!";
+    if (!error.empty()) {
+      fprintf(stderr, "%s:%d: %s\n", fname, n, error.c_str());
+      return EXIT_FAILURE;
+    }
+    jobs.push_back(job);
+    graphs.push_back(graphviz_fname);
+  }
+
+  int n_broken = 0;
+  try {
+    crawler c(engine);
+    running = &c;
+    std::signal(SIGINT, sighandler);
+    for (size_t k = 0; k < jobs.size(); k++) {
+      crawl_callbacks callbacks;
+      callbacks.on_message = print_message;
+      callbacks.on_done = [k, &graphs, &n_broken](crawl_result &r) {
+        print_job(k + 1, r);
+        for (const auto &url : r.broken_links)
+          printf("  HTTP %d: %s\n", std::get<0>(url), std::get<1>(url).c_str());
+        n_broken += r.broken_links.size();
+        if (!graphs[k].empty())
+          write_graphviz(r.network, graphs[k].c_str());
+        fflush(stdout);
+      };
+      c.submit(jobs[k], callbacks);
+    }
+    while (c.step())
+      ;
+    running = nullptr;
+  } catch (std::exception &err) {
+    fprintf(stderr, "%s\n", err.what());
+    return EXIT_FAILURE;
+  }
+  printf("\nSummary: %zu crawls, %d broken links.\n", jobs.size(), n_broken);
+  return n_broken ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Daemon mode. `crawl --daemon <socket>` keeps one crawler, and with it its
+ * connections, DNS and caches, and runs the crawls clients ask for over a
+ * Unix domain socket, side by side. A client sends one line with the
+ * crawl's flags and URL as on the command line (engine flags such as -c
+ * are given to the daemon), and gets back
+ *
+ *   page <url> <links>       for each page parsed
+ *   link <status> <url>      for each link checked, status 0 = no response
+ *   broken <status> <url>    for each broken link, once the crawl is done
+ *   done <checked> <broken> <unchecked>
+ *
+ * or "error <message>". `crawl --connect <socket> ...` is such a client.
+ */
+int n_jobs = 0;
+
+/* blocking write of one line to a client, false once it has gone */
+bool send_reply(int fd, const string &line) {
+  string s = line + "\n";
+  size_t done = 0;
+  while (done < s.size()) {
+    ssize_t n = write(fd, s.data() + done, s.size() - done);
+    if (n > 0)
+      done += n;
+    else if (n < 0 && errno != EINTR)
+      return false;
+  }
+  return true;
+}
+
+/* a connection, from accept() until its crawl is done */
+struct client {
+  string request;
+  std::chrono::steady_clock::time_point accepted;
+  int job;   /* the crawler's id for its crawl, 0 while reading the request */
+  bool gone; /* a write failed, the crawl is cancelled */
+};
+
+std::map<int, client> clients; /* by descriptor */
+
+void drop_client(crawler &c, int fd) {
+  c.unwatch(fd);
+  close(fd);
+  clients.erase(fd);
+}
+
+/* the client's line went out or its crawl is cancelled */
+void reply(crawler &c, int fd, const string &line) {
+  client &cl = clients[fd];
+  if (!cl.gone && !send_reply(fd, line)) {
+    cl.gone = true;
+    c.cancel(cl.job);
+  }
+}
+
+void start_crawl(crawler &c, int fd) {
+  crawl_config job;
+  string graphviz_fname;
+  string error = parse_job_line(clients[fd].request, job, graphviz_fname);
+  if (!error.empty()) {
+    send_reply(fd, "error " + error);
+    drop_client(c, fd);
+    return;
+  }
+
+  /* a client that has gone away doesn't need its crawl finished */
+  crawl_callbacks callbacks;
+  callbacks.on_message = print_message;
+  callbacks.on_page = [&c, fd](const string &url, const std::vector<string> &links) {
+    reply(c, fd, "page " + url + " " + std::to_string(links.size()));
+  };
+  callbacks.on_link = [&c, fd](const string &url, int status) {
+    reply(c, fd, "link " + std::to_string(status) + " " + url);
+  };
+  callbacks.on_done = [&c, fd, graphviz_fname](crawl_result &r) {
+    for (const auto &url : r.broken_links)
+      reply(c, fd, "broken " + std::to_string(std::get<0>(url)) + " " +
+                       std::get<1>(url));
+    reply(c, fd, "done " + std::to_string(r.complete) + " " +
+                     std::to_string(r.broken_links.size()) + " " +
+                     std::to_string(r.queued));
+    print_job(clients[fd].job, r);
+    if (!graphviz_fname.empty())
+      write_graphviz(r.network, graphviz_fname.c_str());
+    n_jobs++;
+    drop_client(c, fd);
+  };
+  try {
+    clients[fd].job = c.submit(job, callbacks);
+  } catch (std::exception &err) {
+    send_reply(fd, string("error ") + err.what());
+    drop_client(c, fd);
+  }
+}
+
+/* read what the client has sent, starting its crawl once a line is in */
+void read_request(crawler &c, int fd) {
+  string &request = clients[fd].request;
+  char buf[4096];
+  ssize_t n = read(fd, buf, sizeof buf);
+  if (n > 0)
+    request.append(buf, n);
+  size_t eol = request.find('\n');
+  if (eol == string::npos) {
+    if (n == 0 || (n < 0 && errno != EINTR) || request.size() >= 65536)
+      drop_client(c, fd);
+    return;
+  }
+  request.erase(eol);
+  c.unwatch(fd);
+  start_crawl(c, fd);
+}
+
+void accept_client(crawler &c, int listen_fd) {
+  int fd = accept(listen_fd, nullptr, nullptr);
+  if (fd < 0)
+    return;
+  /* a client that stops reading must not stall the other crawls */
+  struct timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+  clients[fd] = {string(), std::chrono::steady_clock::now(), 0, false};
+  c.watch(fd, [&c, fd] { read_request(c, fd); });
+}
+
+int run_daemon(const crawler_config &engine, const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof addr.sun_path) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+      listen(listen_fd, 64) != 0) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+
+  /* clients may hang up mid-crawl */
+  std::signal(SIGPIPE, SIG_IGN);
+  try {
+    crawler c(engine);
+    running = &c;
+    std::signal(SIGINT, sighandler);
+    std::signal(SIGTERM, sighandler);
+    c.watch(listen_fd, [&c, listen_fd] { accept_client(c, listen_fd); });
+    printf("Listening on %s . . .\n", path);
+    fflush(stdout);
+    while (!stop_requested) {
+      c.step();
+      /* give up on clients that don't send a request within a few seconds */
+      auto now = std::chrono::steady_clock::now();
+      for (auto p = clients.begin(); p != clients.end();) {
+        int fd = (p++)->first;
+        if (!clients[fd].job && now - clients[fd].accepted > std::chrono::seconds(5))
+          drop_client(c, fd);
+      }
+      fflush(stdout);
+    }
+    /* interrupted crawls still tell their clients how far they got */
+    while (c.step())
+      ;
+    while (!clients.empty())
+      drop_client(c, clients.begin()->first);
+    running = nullptr;
+  } catch (std::exception &err) {
+    fprintf(stderr, "%s\n", err.what());
+    return EXIT_FAILURE;
+  }
+  close(listen_fd);
+  unlink(path);
+  printf("Served %d crawls.\n", n_jobs);
+  return EXIT_SUCCESS;
+}
+
+/* send a crawl to the daemon at path and print what comes back */
+int run_client(const char *path, int argc, char *argv[]) {
+  string line;
+  for (int i = 0; i < argc; i++) {
+    if (i)
+      line += ' ';
+    line += argv[i];
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+      !send_reply(fd, line)) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+
+  bool failed = false;
+  string in;
+  char buf[16384];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof buf)) > 0) {
+    in.append(buf, n);
+    size_t eol;
+    while ((eol = in.find('\n')) != string::npos) {
+      if (!in.compare(0, 7, "broken ") || !in.compare(0, 6, "error "))
+        failed = true;
+      fwrite(in.data(), 1, eol + 1, stdout);
+      in.erase(0, eol + 1);
+    }
+  }
+  close(fd);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
   if (argc < 2) {
     print_usage(argv[0]);
@@ -208,7 +737,12 @@ int main(int argc, char *argv[]) {
 
   int verbose = 0;
   int i = 1;
-  char *graphviz_fname = (char *)"out.gv";
+  const char *graphviz_fname = "out.gv";
+  const char *daemon_socket = nullptr;
+  const char *jobs_fname = nullptr;
+  int n_shards = 1;
+  crawler_config engine;
+  crawl_config job;
 
   try {
     for (i = 1; i < argc; i++) {
@@ -216,22 +750,25 @@ int main(int argc, char *argv[]) {
         print_usage(argv[0]);
         std::exit(EXIT_SUCCESS);
       } else if (has_flag(argv[i], "-v")) {
-        verbose = strlen(argv[i]) - 1;
+        verbose = engine.verbose = strlen(argv[i]) - 1;
       } else if (has_flag(argv[i], "-V", "--version")) {
         print_version(argv[0]);
         std::exit(EXIT_SUCCESS);
-      } else if (has_flag(argv[i], "-c", "--max-con")) {
-        max_con = std::stoi(argv[++i]);
-      } else if (has_flag(argv[i], "-t", "--max-total")) {
-        max_total = std::stoi(argv[++i]);
-      } else if (has_flag(argv[i], "-r", "--max-requests")) {
-        max_requests = std::stoi(argv[++i]);
-      } else if (has_flag(argv[i], "-m", "--max-link-per-page")) {
-        max_link_per_page = std::stoi(argv[++i]);
-      } else if (has_flag(argv[i], "-m", "--max-link-per-page")) {
-        graphviz_fname = argv[++i];
+      } else if (parse_job_flag(argv, i, job, graphviz_fname) ||
+                 parse_engine_flag(argv, i, engine)) {
+        continue;
+      } else if (has_flag(argv[i], "--shards")) {
+        n_shards = std::max(1, std::stoi(argv[++i]));
+      } else if (has_flag(argv[i], "--jobs")) {
+        jobs_fname = argv[++i];
+      } else if (has_flag(argv[i], "--daemon")) {
+        daemon_socket = argv[++i];
+      } else if (has_flag(argv[i], "--connect")) {
+        /* everything after the socket describes the crawl */
+        const char *socket_path = argv[++i];
+        return run_client(socket_path, argc - i - 1, argv + i + 1);
       } else if (i == argc-1) {
-        start_url = argv[i];
+        job.start_url = argv[i];
       } else {
         fprintf(stderr, "Unknown flag: %s\n", argv[i]);
         std::exit(EXIT_FAILURE);
@@ -245,111 +782,134 @@ int main(int argc, char *argv[]) {
     std::exit(EXIT_FAILURE);
   }
 
-  if (start_url == nullptr) {
-    fprintf(stderr, "%s: no URL specified!\n", argv[0]);
+  /* -r of a single crawl caps the engine too, or all crawls it runs */
+  engine.max_requests = job.max_requests;
+  if ((daemon_socket || jobs_fname) && n_shards > 1) {
+    fprintf(stderr, "%s: --shards cannot be combined with --%s\n", argv[0],
+            daemon_socket ? "daemon" : "jobs");
     std::exit(EXIT_FAILURE);
   }
+  if (daemon_socket)
+    return run_daemon(engine, daemon_socket);
+  if (jobs_fname)
+    return run_jobs(engine, job, jobs_fname);
 
-  std::signal(SIGINT, sighandler);
-  LIBXML_TEST_VERSION;
-  curl_global_init(CURL_GLOBAL_DEFAULT);
-  CURLM *multi_handle = curl_multi_init();
-  curl_multi_setopt(multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS, max_con);
-  curl_multi_setopt(multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, 6L);
-
-  /* enables http/2 if available */
-#ifdef CURLPIPE_MULTIPLEX
-  curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
-#endif
-
-  /* sets html start page */
-  curl_multi_add_handle(multi_handle, make_handle(start_url));
-
-  printf("Starting crawler at %s . . .\n", start_url);
+  /* a resumed crawl takes its URL from the checkpoint */
+  if (job.start_url.empty() && job.resume_dir.empty()) {
+    fprintf(stderr, "%s: no URL specified!\n", argv[0]);
+    std::exit(EXIT_FAILURE);
+  }
 
-  int msgs_left;
-  int pending = 0;
-  int complete = 0;
-  std::vector<std::tuple<int, string> > broken_links;
-  int still_running = 1;
-  while (still_running && !pending_interrupt) {
-    int numfds;
-    curl_multi_wait(multi_handle, NULL, 0, 1000, &numfds);
-    curl_multi_perform(multi_handle, &still_running);
-
-    /* See how the transfers went */
-    CURLMsg *m = NULL;
-    while ((m = curl_multi_info_read(multi_handle, &msgs_left))) {
-      if (m->msg == CURLMSG_DONE) {
-        CURL *handle = m->easy_handle;
-        char *url;
-        string *mem;
-        curl_easy_getinfo(handle, CURLINFO_PRIVATE, &mem);
-        curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url);
-        if (m->data.result == CURLE_OK) {
-          long res_status;
-          curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &res_status);
-          if (res_status == 200) {
-            char *ctype;
-            curl_easy_getinfo(handle, CURLINFO_CONTENT_TYPE, &ctype);
-            if (verbose > 0)
-              printf("[%d] HTTP 200 (%s): %s\n", complete, ctype, url);
-            if (is_html(ctype) && mem->size() > 100) {
-              if (pending < max_requests && (complete + pending) < max_total) {
-                pending += follow_links(multi_handle, mem, url);
-                still_running = 1;
-              }
-            }
-          } else {
-            broken_links.push_back({(int)res_status, url});
-            if (verbose > 0)
-              printf("[%d] HTTP %d: %s\n", complete, (int)res_status, url);
-          }
-        } else {
-          if (verbose > 0)
-            printf("[%d] Connection failure: %s\n", complete, url);
-        }
-        curl_multi_remove_handle(multi_handle, handle);
-        curl_easy_cleanup(handle);
-        delete mem;
-        complete++;
-        pending--;
-      }
+  if (n_shards > 1) {
+    if (!job.checkpoint_dir.empty() || !job.resume_dir.empty()) {
+      fprintf(stderr, "%s: --shards cannot be combined with checkpoints\n",
+              argv[0]);
+      std::exit(EXIT_FAILURE);
     }
+    fork_shards(n_shards, engine, job, graphviz_fname);
+  }
+
+  crawl_result r;
+  try {
+    crawler c(engine);
+    running = &c;
+    std::signal(SIGINT, sighandler);
+    crawl_callbacks callbacks;
+    callbacks.on_message = print_message;
+    r = c.run(job, callbacks);
+    running = nullptr;
+  } catch (std::exception &err) {
+    fprintf(stderr, "%s: %s\n", argv[0], err.what());
+    std::exit(EXIT_FAILURE);
   }
 
-  curl_multi_cleanup(multi_handle);
-  curl_global_cleanup();
+  /* only shards get here with --shards, the parent prints the summary */
+  if (n_shards > 1)
+    return EXIT_SUCCESS;
 
   /* print summary */
-  if (int n_broken = broken_links.size()) {
-    printf("\nSummary: %d/%d links are broken.\n", n_broken, complete);
-
-    for (const auto &url : broken_links) {
-      printf("  HTTP %d: %s\n", std::get<0>(url), std::get<1>(url).c_str());
+  if (job.deadline > 0 && r.queued) {
+    printf("\nDeadline: %zu queued links not checked, %d transfers timed out.\n",
+           r.queued, r.timed_out);
+  }
+  print_broken(r.broken_links, r.complete, r.network);
+  if (!r.suppressed.empty()) {
+    std::vector<std::pair<int, string> > patterns;
+    int n_suppressed = 0;
+    for (const auto &p : r.suppressed) {
+      patterns.push_back({p.second, p.first});
+      n_suppressed += p.second;
     }
-  } else {
-    printf("\nSummary: checked %d links, no broken links found.\n", network.num_nodes());
+    std::sort(patterns.rbegin(), patterns.rend());
+    printf("Suppressed %d links matching %zu crawler trap patterns:\n",
+           n_suppressed, patterns.size());
+    for (size_t i = 0; i < patterns.size() && (i < 10 || verbose > 0); i++)
+      printf("  %6d  %s\n", patterns[i].first, patterns[i].second.c_str());
+  }
+  for (const auto &h : r.host_stats) {
+    if (h.down)
+      printf("Host down: %s (%s), %d links not checked.\n", h.origin.c_str(),
+             h.down_reason.c_str(), h.skipped);
+  }
+  if (r.redirects_followed || r.redirects_deduped || r.rewrites_saved)
+    printf("Redirects: %d followed, %d to pages already seen, %d round trips "
+           "saved by learned rewrites.\n",
+           r.redirects_followed, r.redirects_deduped, r.rewrites_saved);
+  if (r.retries)
+    printf("Retried %d transfers, %d of the retry budget left.\n", r.retries,
+           r.retry_budget);
+  if (!engine.cache.empty())
+    printf("Cache: %d/%d pages not modified since the last crawl.\n",
+           r.not_modified, r.complete);
+  if (job.revisit_budget >= 0)
+    printf("Revisits: %d cached pages due, %d changed, %d taken from the cache.\n",
+           r.revisits, r.pages_changed, r.revisits_deferred);
+  if (!engine.status_cache.empty())
+    printf("Cache: %d/%d off-site links answered from the status cache.\n",
+           r.status_hits, r.complete);
+  if (job.sitemap)
+    printf("Sitemaps: %d loaded with %d fetches, %d links queued from them.\n",
+           r.sitemaps_loaded, r.sitemap_fetches, r.sitemap_links);
+  if (!engine.shared_seen.empty())
+    printf("Shared: %d off-site links skipped, checked by another crawl, %zu "
+           "without a stored status.\n",
+           r.shared_skips, r.unchecked_links.size());
+  if (r.dns_resolved || r.dns_hits)
+    printf("DNS: %zu hosts resolved ahead of time, %zu transfers skipped the "
+           "lookup.\n",
+           r.dns_resolved, r.dns_hits);
+  printf("Connections: %ld opened for %d transfers, %d admitted to warm hosts.\n",
+         r.new_connections, r.complete, r.warm_admits);
+  printf("Traffic: %.2f MB received, %.1f req/s, %.2f Mbit/s on average.\n",
+         r.bytes_received / 1e6, r.complete / r.elapsed,
+         r.bytes_received * 8 / 1e6 / r.elapsed);
+  if (verbose > 0) {
+    printf("Buffers: %zu reused, %zu presized from Content-Length, %zu "
+           "reallocations avoided, %.2f MB peak.\n",
+           r.buffers_reused, r.buffers_presized, r.reallocs_avoided,
+           r.buffers_peak / 1e6);
+    if (engine.parsers > 0)
+      printf("Parsers: %d pages parsed on %d threads, %zu stolen.\n",
+             r.pages_parsed, engine.parsers, r.parser_steals);
+    for (const auto &l : r.lane_stats)
+      printf("  %s lane: %d fetched, %zu left in queue\n", l.name, l.completed,
+             l.queued);
   }
   if (verbose > 1) {
+    printf("\nTimeouts per host:\n");
+    for (const auto &h : r.host_stats)
+      printf("  %6ld ms (connect %5ld ms, %d samples)  %s\n", h.timeout_ms,
+             h.connect_timeout_ms, h.samples, h.origin.c_str());
     printf("\n");
-    network.print();
+    r.network.print();
     printf("\n");
   }
 
-  FILE *fptr = std::fopen(graphviz_fname, "w");
-  if (fptr) {
-    network.to_graphviz(fptr);
-    printf("Wrote GraphViz output to %s\n", graphviz_fname);
-    fclose(fptr);
-  } else {
-    fprintf(stderr, "Failed to write graphviz output to %s\n",
-            graphviz_fname == nullptr ? "out.gv" : graphviz_fname);
+  if (!write_graphviz(r.network, graphviz_fname))
     std::exit(EXIT_FAILURE);
-  }
   auto end = std::chrono::steady_clock::now();
   std::chrono::duration<double> diff = end - start;
   printf("Took %.3fs\n", diff.count());
 
-  return broken_links.size() ? EXIT_FAILURE : EXIT_SUCCESS;
+  return r.broken_links.size() ? EXIT_FAILURE : EXIT_SUCCESS;
 }
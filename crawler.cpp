@@ -0,0 +1,2139 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Web crawler based on curl and libxml2.
+ * Copyright (C) 2018 - 2020 Jeroen Ooms <jeroenooms@gmail.com>
+ * License: MIT
+ *
+ * Ported to C++ by Tiger Nie 2020
+ *
+ * The crawl engine behind crawl(1) and libcrawl, see crawler.hpp.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+#include <libxml/HTMLparser.h>
+#include <libxml/parser.h>
+#include <libxml/uri.h>
+#include <libxml/xpath.h>
+
+#include "crawler.hpp"
+#include "shard.hpp"
+
+#include "affinity.hpp"
+#include "buffer_pool.hpp"
+#include "coro.hpp"
+#include "dns_prefetcher.hpp"
+#include "fingerprint.hpp"
+#include "latency_histogram.hpp"
+#include "mpmc_queue.hpp"
+#include "ngraph.hpp"
+#include "page_cache.hpp"
+#include "rewrite_rules.hpp"
+#include "seen_set.hpp"
+#include "shared_seen.hpp"
+#include "status_cache.hpp"
+#include "token_bucket.hpp"
+#include "trap_detector.hpp"
+#include "work_stealing_pool.hpp"
+
+using std::string;
+
+namespace {
+
+bool engine_live = false;
+
+/* The shard this process crawls as, see crawl_as_shard() */
+struct shard_settings {
+  int n_shards = 1;
+  int shard_id = 0;
+  int router_fd = -1; /* -1 = not sharded */
+};
+
+shard_settings process_shard;
+
+int follow_relative_links = 1;
+
+const char *useragent =
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/88.0.4292.0 Safari/537.36";
+
+/* Connection limits, also used to judge free capacity on a connection */
+const long max_host_con = 6;
+const long max_streams = 100;
+
+/* How far into a lane's queue to look for URLs on warm connections */
+const size_t affinity_window = 32;
+
+/* Consecutive connection failures after which a host is considered down */
+const int breaker_threshold = 3;
+
+/*
+ * Timeouts. Once a host has enough samples its transfer timeout becomes
+ * p99 of its latency times timeout_factor, so slow but healthy hosts get
+ * more time. The connect timeout does the same from connect times, falling
+ * back to those of all hosts, so dead hosts release their slot quickly.
+ */
+const long default_timeout_ms = 5000;
+const long default_connect_timeout_ms = 2000;
+
+/*
+ * Per-origin connection state, used to route URLs to warm connections and
+ * to stop spending slots on hosts that are down. A host that fails to
+ * resolve, or fails to connect breaker_threshold times in a row, has its
+ * circuit opened: its URLs are skipped for a cooldown that doubles on
+ * every trip, after which a single probe transfer decides whether it
+ * closes again.
+ */
+struct host_state {
+  int in_flight = 0;
+  bool multiplexed = false;
+  std::chrono::steady_clock::time_point last_done;
+
+  int failures = 0;
+  int trips = 0;
+  bool tripped = false;
+  std::chrono::steady_clock::time_point open_until;
+  string down_reason;
+  int skipped = 0; /* URLs not fetched while the host was down */
+
+  latency_histogram latency;       /* total time of successful transfers */
+  latency_histogram connect_times; /* time until connected, incl. DNS */
+
+  long timeout_ms(double factor) const {
+    return latency.timeout_ms(factor, default_timeout_ms, 1000, 30000);
+  }
+
+  /* all_hosts: connect times of all hosts, for hosts with few samples */
+  long connect_timeout_ms(const latency_histogram &all_hosts, double factor) const {
+    const latency_histogram &h =
+        connect_times.samples() >= latency_histogram::min_samples ? connect_times
+                                                                  : all_hosts;
+    return h.timeout_ms(factor, default_connect_timeout_ms, 1000, 10000);
+  }
+
+  /* an open connection with room for another transfer is likely */
+  bool warm() const {
+    if (in_flight == 0 &&
+        std::chrono::steady_clock::now() - last_done > std::chrono::seconds(30))
+      return false;
+    return in_flight < (multiplexed ? max_streams : max_host_con);
+  }
+
+  /* URLs for this host should not be fetched now */
+  bool down() const {
+    if (!tripped)
+      return false;
+    if (std::chrono::steady_clock::now() < open_until)
+      return true;
+    return in_flight > 0; /* half open, one probe at a time */
+  }
+
+  void connection_ok() {
+    failures = 0;
+    tripped = false;
+  }
+
+  /* returns true the first time the host trips */
+  bool connection_failed(CURLcode res) {
+    failures++;
+    if (res != CURLE_COULDNT_RESOLVE_HOST && failures < breaker_threshold)
+      return false;
+    int cooldown = std::min(300, 30 << std::min(trips, 4));
+    open_until = std::chrono::steady_clock::now() + std::chrono::seconds(cooldown);
+    tripped = true;
+    down_reason = curl_easy_strerror(res);
+    return trips++ == 0;
+  }
+};
+
+/* scheme://host[:port], the unit curl reuses connections for */
+string url_origin(const string &url) {
+  size_t p = url.find("://");
+  if (p == string::npos)
+    return string();
+  return url.substr(0, url.find_first_of("/?#", p + 3));
+}
+
+/*
+ * Scheduling lanes. Each lane has its own queue of URLs discovered but not
+ * yet handed to curl, and its own concurrency and rate budget, so slow
+ * off-site link checks can't stall discovery of in-scope pages.
+ */
+enum lane_id { CRAWL_LANE, EXTERNAL_LANE, RETRY_LANE, N_LANES };
+
+struct lane {
+  const char *name;
+  int max_con;  /* max transfers in flight, 0 = derive from max_requests */
+  double rate;  /* max requests per second, 0 = unlimited */
+  std::deque<string> frontier;
+  token_bucket bucket;
+  int in_flight;
+  int completed;
+  size_t skips; /* admissions that passed over the head of the queue */
+};
+
+/* partition graph edges by the host of the linking page */
+struct host_partition {
+  size_t operator()(const string &url) const {
+    return std::hash<string>()(url_origin(url));
+  }
+};
+
+/* Running estimate of transfer latency (EWMA of mean and deviation) */
+struct latency_estimate {
+  double mean = 0;
+  double dev = 0;
+  int samples = 0;
+
+  void add(double secs) {
+    if (samples++ == 0) {
+      mean = secs;
+      dev = secs / 2;
+      return;
+    }
+    double err = secs - mean;
+    mean += 0.125 * err;
+    dev += 0.25 * (std::fabs(err) - dev);
+  }
+
+  /* pessimistic time a newly admitted transfer will take */
+  double upper() const { return mean + 4 * dev; }
+};
+
+class fetch;
+
+/*
+ * State of one crawl, from submit() until its result is handed back: the
+ * crawl_result it fills in, plus its frontiers, seen-set and limits.
+ * Everything else belongs to the engine and outlives the crawl.
+ */
+struct crawl_job : crawl_result {
+  int id = 0;
+  crawl_config config;
+  crawl_callbacks callbacks;
+
+  /* Nodes of the network graph, safe to test and claim from parser threads */
+  seen_set seen;
+
+  /* Per-host URL pattern counts, to stop crawling infinite URL spaces */
+  trap_detector traps;
+
+  /* Host-wide redirects (https, www, trailing slash) learned during the crawl */
+  rewrite_rules rewrites;
+
+  lane lanes[N_LANES] = {
+      {"crawl", 0, 0, {}, token_bucket(), 0, 0, 0},
+      {"external", 0, 0, {}, token_bucket(), 0, 0, 0},
+      {"retry", 0, 0, {}, token_bucket(), 0, 0, 0},
+  };
+
+  /* see schedule_retry() */
+  std::map<string, int> attempts;
+  std::multimap<std::chrono::steady_clock::time_point, string> retry_queue;
+
+  /* see follow_redirect() */
+  std::map<string, int> redirect_hops;
+
+  /* Queued rewrites of links, to the link, see undo_rewrite() */
+  std::map<string, string> rewritten;
+
+  /* Links from the start page to queued in-scope pages, with max_depth */
+  std::map<string, int> depths;
+
+  /* Off-site links claimed by another crawl, see finish_job() */
+  std::vector<string> shared_skipped;
+
+  /* Hosts the crawl has fetched from or skipped, for its host_stats */
+  std::set<string> origins;
+
+  /* Cached pages to fetch again, with a revisit budget, see plan_revisits() */
+  std::set<string> due;
+
+  /* Sitemap fetches waiting for a slot, see admit_one() */
+  std::deque<fetch *> fetches;
+
+  /* Edges recorded by parser threads, merged into `network` by merge_edges() */
+  NGraph::tGraphBuilder<string, host_partition> parsed_edges;
+
+  int pending = 0; /* transfers handed to curl */
+  int parsing = 0; /* parse jobs submitted and not yet finished */
+  int tasks = 0;   /* sitemap pipelines running, see job_task */
+  latency_estimate latency;
+
+  /* see start_job() and crawler::step() */
+  std::chrono::steady_clock::time_point started, cutoff, last_checkpoint;
+  int checkpoint_generation = 0; /* the one meta commits, see save_checkpoint() */
+  long remaining_ms = -1; /* until the deadline, -1 = none */
+  bool admitting = true;
+  bool blocked[N_LANES] = {}; /* lanes waiting for rate tokens this step */
+  bool cancelled = false;
+  bool done = false;
+};
+
+/* counts a running sitemap pipeline of a job, from a coroutine's frame */
+struct job_task {
+  crawl_job *job;
+  explicit job_task(crawl_job *j) : job(j) { job->tasks++; }
+  ~job_task() { job->tasks--; }
+};
+
+// Only follow links from the start domain
+// TODO: This only allows link following if the url
+// begins with the start_url, so we start with
+// https://www.example.com/foo we won't follow
+// links from https://www.example.com/bar
+bool in_scope(const crawl_job &j, const char *url) {
+  return !strncmp(url, j.start_url.c_str(), j.start_url.size());
+}
+
+size_t queued(const crawl_job &j) {
+  size_t n = 0;
+  for (const auto &l : j.lanes)
+    n += l.frontier.size();
+  return n;
+}
+
+void merge_edges(crawl_job &j) { j.parsed_edges.build(j.network); }
+
+/* links between the start page and url, as far as the crawl knows */
+int depth_of(const crawl_job &j, const string &url) {
+  auto p = j.depths.find(url);
+  return p == j.depths.end() ? 0 : p->second;
+}
+
+/* the links of url should be followed */
+bool below_max_depth(const crawl_job &j, const string &url) {
+  return j.config.max_depth <= 0 || depth_of(j, url) < j.config.max_depth;
+}
+
+/*
+ * Retries. Transfers that fail in a way worth retrying wait out a jittered
+ * exponential backoff in retry_queue and are then fetched through the
+ * retry lane, as long as the URL has attempts left and the crawl as a
+ * whole has retry budget left.
+ */
+
+bool is_retryable(CURLcode res) {
+  switch (res) {
+  case CURLE_OPERATION_TIMEDOUT:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_PARTIAL_FILE:
+  case CURLE_HTTP2:
+  case CURLE_HTTP2_STREAM:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool is_retryable_status(long status) {
+  return status == 429 || status == 502 || status == 503 || status == 504;
+}
+
+/* Per-transfer state, stored as CURLOPT_PRIVATE */
+struct transfer {
+  string url;
+  string body;
+  lane_id lane;
+  host_state *host;
+  CURL *handle;
+  string etag;
+  struct curl_slist *headers;
+  struct curl_slist *resolve;
+  fetch *waiter; /* coroutine awaiting this transfer, see fetch */
+  crawl_job *job;
+  crawl_engine *engine;
+  curl_off_t received; /* bytes charged to the byte budget so far */
+};
+
+/* HREF finder implemented in libxml2 but could be any HTML parser */
+std::vector<string> extract_links(const string &mem, const char *url) {
+  std::vector<string> links;
+  int opts = HTML_PARSE_NOBLANKS | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING |
+             HTML_PARSE_NONET;
+  htmlDocPtr doc = htmlReadMemory(mem.c_str(), mem.size(), url, NULL, opts);
+  if (!doc)
+    return links;
+  xmlChar *xpath = (xmlChar *)"//a/@href";
+  xmlXPathContextPtr context = xmlXPathNewContext(doc);
+  xmlXPathObjectPtr result = xmlXPathEvalExpression(xpath, context);
+  xmlXPathFreeContext(context);
+  if (!result) {
+    xmlFreeDoc(doc);
+    return links;
+  }
+  xmlNodeSetPtr nodeset = result->nodesetval;
+  if (xmlXPathNodeSetIsEmpty(nodeset)) {
+    xmlXPathFreeObject(result);
+    xmlFreeDoc(doc);
+    return links;
+  }
+
+  for (int i = 0; i < nodeset->nodeNr; i++) {
+    const xmlNode *node = nodeset->nodeTab[i]->xmlChildrenNode;
+    xmlChar *href = xmlNodeListGetString(doc, node, 1);
+    if (follow_relative_links) {
+      xmlChar *orig = href;
+      href = xmlBuildURI(href, (xmlChar *)url);
+      xmlFree(orig);
+    }
+    // remove fragment
+    xmlURIPtr uri = xmlParseURI((const char *)href);
+    xmlFree(href);
+    if (!uri)
+      continue;
+    xmlFree(uri->fragment);
+    uri->fragment = nullptr;
+    char *link = (char *)xmlSaveUri(uri);
+    xmlFreeURI(uri);
+    if (!link)
+      continue;
+    if (strlen(link) >= 20 &&
+        (!strncmp(link, "http://", 7) || !strncmp(link, "https://", 8)))
+      links.push_back(link);
+    xmlFree(link);
+  }
+  xmlXPathFreeObject(result);
+  xmlFreeDoc(doc);
+  return links;
+}
+
+/* blocking write of one protocol line */
+void send_line(int fd, const string &line) {
+  string s = line + "\n";
+  size_t done = 0;
+  while (done < s.size()) {
+    ssize_t n = write(fd, s.data() + done, s.size() - done);
+    if (n >= 0) {
+      done += n;
+    } else if (errno == EAGAIN) {
+      struct pollfd p = {fd, POLLOUT, 0};
+      poll(&p, 1, -1);
+    } else if (errno != EINTR) {
+      return;
+    }
+  }
+}
+
+/*
+ * Pages are parsed on a pool of threads so that sockets keep being
+ * serviced while a large page is parsed. A parse job takes over the body
+ * buffer of its transfer; the links come back through `parsed` and are
+ * recorded on the network thread, which owns the graph and the frontiers.
+ * `parsed` is bounded, so parsers wait for the network thread to catch up
+ * rather than pile up finished pages.
+ */
+struct parse_job {
+  crawl_job *job;
+  string url;  /* as requested, the page cache key */
+  string base; /* effective URL, for resolving relative links */
+  string body;
+  string etag;
+  long last_modified;
+  uint64_t hash; /* of the body, for the page's change history */
+  std::vector<string> links;
+  std::vector<signed char> claimed; /* see follow_links() */
+};
+
+/*
+ * <loc> values of a sitemap or sitemap index, which one it is in `index`.
+ * Parsed like pages are, so CDATA, entities, comments and namespace
+ * prefixes read as they should.
+ */
+std::vector<string> sitemap_locs(const string &xml, bool &index) {
+  std::vector<string> locs;
+  index = false;
+  int opts = XML_PARSE_NOBLANKS | XML_PARSE_NOERROR | XML_PARSE_NOWARNING |
+             XML_PARSE_NONET;
+  xmlDocPtr doc = xmlReadMemory(xml.c_str(), xml.size(), nullptr, nullptr, opts);
+  if (!doc)
+    return locs;
+  xmlNodePtr root = xmlDocGetRootElement(doc);
+  index = root && !xmlStrcmp(root->name, (const xmlChar *)"sitemapindex");
+  /* <urlset><url><loc> or <sitemapindex><sitemap><loc> */
+  xmlChar *xpath = (xmlChar *)"/*/*/*[local-name()='loc']";
+  xmlXPathContextPtr context = xmlXPathNewContext(doc);
+  xmlXPathObjectPtr result = xmlXPathEvalExpression(xpath, context);
+  xmlXPathFreeContext(context);
+  if (result && !xmlXPathNodeSetIsEmpty(result->nodesetval)) {
+    xmlNodeSetPtr nodeset = result->nodesetval;
+    for (int i = 0; i < nodeset->nodeNr; i++) {
+      xmlChar *text = xmlNodeGetContent(nodeset->nodeTab[i]);
+      string loc = text ? (const char *)text : "";
+      xmlFree(text);
+      size_t begin = loc.find_first_not_of(" \t\r\n");
+      size_t last = loc.find_last_not_of(" \t\r\n");
+      if (begin != string::npos)
+        locs.push_back(loc.substr(begin, last - begin + 1));
+    }
+  }
+  xmlXPathFreeObject(result);
+  xmlFreeDoc(doc);
+  return locs;
+}
+
+/*
+ * Redirects are handled by the crawler rather than by curl, so a target
+ * that has been seen already is not downloaded again and the graph gets
+ * an explicit edge from the redirecting URL to its target.
+ */
+const int max_redirects = 3;
+
+bool is_redirect(long status) {
+  return status == 301 || status == 302 || status == 303 || status == 307 ||
+         status == 308;
+}
+
+int is_html(char *ctype) {
+  return ctype != NULL && strlen(ctype) > 10 && strstr(ctype, "text/html");
+}
+
+/*
+ * Checkpoints are a directory of plain text files. Each checkpoint writes
+ * a new generation of the data files, suffixed with its number, and then
+ * commits it by renaming a new meta into place, which names the
+ * generation. An interrupted write never leaves a torn checkpoint behind:
+ * meta still names the previous generation, whose files are only removed
+ * once the new one is committed.
+ *
+ *   meta          start url, number of completed transfers and generation
+ *   graph.<n>     the network graph, which doubles as the seen-set
+ *   frontier.<n>  "<lane> <url>" for queued and in-flight URLs
+ *   broken.<n>    "<status> <url>" for broken links found so far
+ *   traps.<n>     crawler trap pattern counts
+ */
+const char *checkpoint_files[] = {"graph", "frontier", "broken", "traps"};
+
+string generation_suffix(int generation) {
+  return "." + std::to_string(generation);
+}
+
+/* generation the meta in dir commits, 0 if none */
+int stored_generation(const string &dir) {
+  std::ifstream meta(dir + "/meta");
+  string key, value;
+  while (meta >> key >> value)
+    if (key == "generation")
+      return std::stoi(value);
+  return 0;
+}
+
+void remove_generation(const string &dir, int generation) {
+  for (const char *name : checkpoint_files)
+    std::remove((dir + "/" + name + generation_suffix(generation)).c_str());
+}
+
+bool load_checkpoint(crawl_job &j) {
+  string base = j.config.resume_dir + "/";
+  std::ifstream meta(base + "meta");
+  if (!meta)
+    return false;
+  string key, value;
+  int generation = 0;
+  while (meta >> key >> value) {
+    if (key == "start_url" && j.start_url.empty())
+      j.start_url = value;
+    else if (key == "complete")
+      j.complete = std::stoi(value);
+    else if (key == "generation")
+      generation = std::stoi(value);
+  }
+  if (generation == 0)
+    return false;
+  string suffix = generation_suffix(generation);
+
+  std::ifstream graph(base + "graph" + suffix);
+  graph >> j.network;
+  for (auto p = j.network.begin(); p != j.network.end(); p++)
+    j.seen.test_and_insert(p->first);
+
+  std::ifstream queue(base + "frontier" + suffix);
+  while (queue >> key >> value) {
+    int id = CRAWL_LANE;
+    for (int k = 0; k < N_LANES; k++)
+      if (key == j.lanes[k].name)
+        id = k;
+    j.lanes[id].frontier.push_back(value);
+  }
+
+  std::ifstream broken(base + "broken" + suffix);
+  int status;
+  while (broken >> status >> value)
+    j.broken_links.push_back({status, value});
+
+  std::ifstream trap_counts(base + "traps" + suffix);
+  j.traps.load(trap_counts);
+  return true;
+}
+
+/* pass a progress message on to the embedder */
+void notify(const crawl_job &j, const string &message) {
+  if (j.callbacks.on_message)
+    j.callbacks.on_message(message);
+}
+
+/* a link's check is done, for good */
+void checked(crawl_job &j, const string &url, int status) {
+  j.complete++;
+  if (j.callbacks.on_link)
+    j.callbacks.on_link(url, status);
+}
+
+} // namespace
+
+/*
+ * Everything a crawler keeps between crawls, and the crawls in progress.
+ * Lives behind crawler so the public header stays free of curl and of
+ * the engine's internals.
+ */
+class crawl_engine {
+public:
+  explicit crawl_engine(const crawler_config &settings);
+  ~crawl_engine();
+
+  /* Settings of the engine, see crawler_config */
+  crawler_config config;
+  shard_settings shard;
+
+  /* Off-site links claimed by any of the processes sharing the table */
+  shared_seen shared;
+
+  /* Validators and outlinks of parsed pages, for conditional recrawls */
+  page_cache pages;
+
+  /* Recent statuses of off-site links, shared with other runs */
+  status_cache statuses;
+
+  /* Addresses of discovered hosts, resolved in the background */
+  dns_prefetcher resolver;
+  /* Connect times of all hosts, for hosts with too few of their own */
+  latency_histogram all_connect_times;
+
+  std::map<string, host_state> hosts;
+
+  /* Jitter for retry backoff, see schedule_retry() */
+  std::mt19937 rng{std::random_device{}()};
+
+  /* Body buffers recycled between transfers */
+  buffer_pool buffers;
+
+  /*
+   * Global shaping across all lanes. Received bytes are charged to the byte
+   * bucket as they arrive, see charge_received(); once it is in debt,
+   * transfers are paused from the write callback and no new ones are
+   * admitted until it has refilled.
+   */
+  token_bucket request_bucket;
+  token_bucket byte_bucket;
+  std::vector<CURL *> paused;
+
+  /* Transfers handed to curl and not yet completed */
+  CURLM *multi_handle = nullptr;
+  std::set<transfer *> active;
+  /* Set from a signal handler by crawler::interrupt() */
+  volatile sig_atomic_t pending_interrupt = 0;
+
+  /* Shard side of `crawl --shards`, see accept_routed() */
+  int routed_in = 0; /* links received from other shards */
+  bool router_stop = false;
+  string router_buf;
+  int reported_idle = -1;
+  int reported_load = -1;
+
+  /* see parse_page() */
+  work_stealing_pool parsers;
+  mpmc_queue<parse_job *> parsed{1024};
+
+  /*
+   * Crawls in progress. Each step, jobs take turns admitting one transfer
+   * each, starting with a different job every step, until the engine's
+   * request slots are used up or no job can admit any more. A job that
+   * can't use its share leaves it to the others, so slots stay busy and no
+   * job starves behind a bigger one.
+   */
+  std::vector<crawl_job *> running_jobs;
+  int last_job_id = 0;
+  int in_flight = 0; /* lane transfers of all jobs */
+  size_t next_turn = 0;
+
+  /* descriptors the embedder waits on, see crawler::watch() */
+  std::map<int, std::function<void()> > watched;
+
+  bool schedule_retry(crawl_job &j, const string &url, double min_delay = 0);
+  void release_transfer(transfer *t);
+  size_t pick_next(lane &l);
+  host_state *host_of(crawl_job &j, const string &url);
+  CURL *make_handle(transfer *t, long timeout_ms, long connect_timeout_ms);
+  bool owned(const string &url) const;
+  void accept_routed(crawl_job &j, const string &url);
+  void poll_router(crawl_job &j);
+  void report_idle();
+  void send_results(const crawl_job &j);
+  size_t follow_links(crawl_job &j, const std::vector<string> &links,
+                      const char *url,
+                      const std::vector<signed char> &claimed =
+                          std::vector<signed char>());
+  size_t queue_links(crawl_job &j, const std::vector<string> &links,
+                     const char *url, const std::vector<signed char> &claimed);
+  void finish_parse(parse_job *p);
+  void parse_page(parse_job *p);
+  void drain_parsed();
+  detached_task load_sitemap(crawl_job *j, string url, int depth);
+  detached_task discover_sitemaps(crawl_job *j, string origin);
+  bool follow_redirect(crawl_job &j, const string &from, const string &to);
+  bool save_checkpoint(crawl_job &j);
+  bool stopping(const crawl_job &j) const;
+  void plan_revisits(crawl_job &j);
+  void start_job(crawl_job &j);
+  bool tokens_due(crawl_job &j, int lane, long &wait_ms);
+  void take_tokens(crawl_job &j, int lane);
+  void start_transfer(crawl_job &j, lane_id lane, host_state *host,
+                      const string &url, fetch *waiter);
+  bool admit_one(crawl_job &j, long &wait_ms);
+  void drop_fetches(crawl_job &j, CURLcode code);
+  void observe_transfer(transfer *t, CURLcode result);
+  void end_transfer(transfer *t);
+  void rewrite_queued(crawl_job &j);
+  bool undo_rewrite(crawl_job &j, const string &url, bool ok);
+  void complete_transfer(transfer *t, CURLcode result);
+  void finish_job(crawl_job &j);
+  int submit(const crawl_config &config, const crawl_callbacks &callbacks);
+  bool step();
+};
+
+namespace {
+
+//
+//  libcurl write callback function
+//
+int writer(char *data, size_t size, size_t nmemb, transfer *t) {
+  if (!t)
+    return 0;
+  if (t->engine->byte_bucket.wait_time(0) > 0) {
+    t->engine->paused.push_back(t->handle);
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  t->engine->buffers.append(t->body, data, size * nmemb);
+  return size * nmemb;
+}
+
+/*
+ * Charge the body bytes received so far to the byte budget. curl counts
+ * them as they come off the wire, before content decoding, which is what
+ * the bandwidth limit is about; a compressed page takes much less of it
+ * than its decoded size.
+ */
+void charge_received(transfer *t, curl_off_t received) {
+  if (received <= t->received)
+    return;
+  t->engine->byte_bucket.take(received - t->received);
+  t->job->bytes_received += received - t->received;
+  t->received = received;
+}
+
+//
+//  libcurl progress callback
+//
+int progress_cb(transfer *t, curl_off_t, curl_off_t dlnow, curl_off_t, curl_off_t) {
+  charge_received(t, dlnow);
+  return 0;
+}
+
+//
+//  libcurl header callback function, picks up the ETag and presizes the
+//  body buffer from Content-Length
+//
+size_t header_cb(char *data, size_t size, size_t nmemb, transfer *t) {
+  size_t n = size * nmemb;
+  if (n > 15 && !strncasecmp(data, "content-length:", 15)) {
+    long long length = strtoll(string(data + 15, n - 15).c_str(), nullptr, 10);
+    if (length > 0)
+      t->engine->buffers.presize(t->body, length);
+  }
+  if (n > 5 && !strncasecmp(data, "etag:", 5)) {
+    string value(data + 5, n - 5);
+    size_t begin = value.find_first_not_of(" \t");
+    size_t end = value.find_last_not_of(" \t\r\n");
+    t->etag = begin == string::npos ? string() : value.substr(begin, end - begin + 1);
+  }
+  return n;
+}
+
+/*
+ * Awaitable fetches. `co_await fetch(job, url)` queues a transfer for the
+ * job and resumes the coroutine with the response once it is done, so a
+ * pipeline like robots.txt -> sitemaps -> pages reads as straight-line
+ * code, and many of them run concurrently on the network thread. These
+ * transfers are not crawl results, but they are admitted through the crawl
+ * lane like its pages, see admit_one().
+ */
+struct fetch_result {
+  CURLcode result;
+  long status;
+  string content_type;
+  string body;
+};
+
+class fetch {
+public:
+  fetch(crawl_job *job, const string &url) : job_(job), url_(url) {}
+
+  bool await_ready() const { return false; }
+
+  void await_suspend(std::coroutine_handle<> waiting) {
+    waiting_ = waiting;
+    job_->fetches.push_back(this);
+  }
+
+  fetch_result await_resume() { return std::move(result_); }
+
+  const string &url() const { return url_; }
+
+  /* called by the network loop when the transfer has completed */
+  static void complete(transfer *t, CURLcode code) {
+    fetch *f = t->waiter;
+    f->result_.result = code;
+    f->result_.status = 0;
+    char *ctype = nullptr;
+    curl_easy_getinfo(t->handle, CURLINFO_RESPONSE_CODE, &f->result_.status);
+    curl_easy_getinfo(t->handle, CURLINFO_CONTENT_TYPE, &ctype);
+    f->result_.content_type = ctype ? ctype : "";
+    t->engine->buffers.detach(t->body);
+    f->result_.body.swap(t->body);
+    t->engine->end_transfer(t);
+    f->waiting_.resume();
+  }
+
+  /* resume without a transfer, for fetches that never got a slot */
+  void fail(CURLcode code) {
+    result_.result = code;
+    result_.status = 0;
+    waiting_.resume();
+  }
+
+private:
+  crawl_job *job_;
+  string url_;
+  std::coroutine_handle<> waiting_;
+  fetch_result result_;
+};
+
+} // namespace
+
+/* queue url for another attempt, at least min_delay seconds from now */
+bool crawl_engine::schedule_retry(crawl_job &j, const string &url, double min_delay) {
+  int &n = j.attempts[url];
+  if (n >= j.config.max_retries || j.retry_budget <= 0) {
+    j.attempts.erase(url);
+    return false;
+  }
+  std::uniform_real_distribution<double> jitter(0.5, 1.5);
+  double delay = std::max(min_delay, std::min(30.0, 0.5 * (1 << n)) * jitter(rng));
+  n++;
+  j.retry_budget--;
+  j.retries++;
+  j.retry_queue.insert(
+      {std::chrono::steady_clock::now() +
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               std::chrono::duration<double>(delay)),
+       url});
+  return true;
+}
+
+/* take t off the multi handle and free it */
+void crawl_engine::release_transfer(transfer *t) {
+  curl_multi_remove_handle(multi_handle, t->handle);
+  paused.erase(std::remove(paused.begin(), paused.end(), t->handle), paused.end());
+  curl_easy_cleanup(t->handle);
+  active.erase(t);
+  curl_slist_free_all(t->headers);
+  curl_slist_free_all(t->resolve);
+  /* no-op for a body handed to a parser or a fetch, see buffer_pool */
+  buffers.release(t->body);
+  delete t;
+}
+
+/* index of the next URL to admit from a lane, see pick_warm() */
+size_t crawl_engine::pick_next(lane &l) {
+  return pick_warm(l.frontier, affinity_window, l.skips, [this](const string &url) {
+    auto h = hosts.find(url_origin(url));
+    return h != hosts.end() && h->second.warm();
+  });
+}
+
+/* state of the host of url, which the job is about to fetch from */
+host_state *crawl_engine::host_of(crawl_job &j, const string &url) {
+  string origin = url_origin(url);
+  j.origins.insert(origin);
+  return &hosts[origin];
+}
+
+CURL *crawl_engine::make_handle(transfer *t, long timeout_ms, long connect_timeout_ms) {
+  CURL *handle = curl_easy_init();
+  t->handle = handle;
+
+  /* Important: use HTTP2 over HTTPS */
+  curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(handle, CURLOPT_URL, t->url.c_str());
+  /* seed curl's DNS cache with the prefetched address, if any */
+  string resolved = resolver.resolve_entry(t->url);
+  if (!resolved.empty()) {
+    t->resolve = curl_slist_append(t->resolve, resolved.c_str());
+    curl_easy_setopt(handle, CURLOPT_RESOLVE, t->resolve);
+  }
+  /* wait for a connection to multiplex on rather than opening another */
+  curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+
+  /* buffer body */
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writer);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, t);
+  curl_easy_setopt(handle, CURLOPT_PRIVATE, t);
+  curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, header_cb);
+  curl_easy_setopt(handle, CURLOPT_HEADERDATA, t);
+  curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, progress_cb);
+  curl_easy_setopt(handle, CURLOPT_XFERINFODATA, t);
+  curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L);
+
+  /* revalidate pages we have parsed before */
+  if (const page_entry *cached = pages.find(t->url)) {
+    if (!cached->etag.empty()) {
+      t->headers = curl_slist_append(
+          t->headers, ("If-None-Match: " + cached->etag).c_str());
+      curl_easy_setopt(handle, CURLOPT_HTTPHEADER, t->headers);
+    }
+    if (cached->last_modified > 0) {
+      curl_easy_setopt(handle, CURLOPT_TIMECONDITION, CURL_TIMECOND_IFMODSINCE);
+      curl_easy_setopt(handle, CURLOPT_TIMEVALUE, cached->last_modified);
+    }
+  }
+
+  /* For completeness */
+  curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, timeout_ms);
+  /* redirects are followed by the crawler, see follow_redirect() */
+  curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 0L);
+  curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms);
+  curl_easy_setopt(handle, CURLOPT_COOKIEFILE, "");
+  curl_easy_setopt(handle, CURLOPT_FILETIME, 1L);
+  curl_easy_setopt(handle, CURLOPT_USERAGENT, useragent);
+  curl_easy_setopt(handle, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+  curl_easy_setopt(handle, CURLOPT_UNRESTRICTED_AUTH, 1L);
+  curl_easy_setopt(handle, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+  curl_easy_setopt(handle, CURLOPT_EXPECT_100_TIMEOUT_MS, 0L);
+
+  /* no single transfer may use more than the whole bandwidth budget */
+  if (!byte_bucket.unlimited())
+    curl_easy_setopt(handle, CURLOPT_MAX_RECV_SPEED_LARGE,
+                     (curl_off_t)byte_bucket.rate());
+
+  return handle;
+}
+
+/*
+ * Multi-process sharding, the shard's side. With `crawl --shards K` the
+ * crawl is split over K forked processes, each owning the hosts whose
+ * origin hashes to it, so no process shares its graph, libcurl or libxml2
+ * state. A shard sends links to other shards' hosts to the parent, which
+ * routes them to their owner over Unix domain sockets, notices when all
+ * shards have run dry and merges their graphs and broken links. Each shard
+ * reports how many links it has taken on, and once all of them together
+ * reach max_total the parent tells them to stop taking on more.
+ *
+ * Shard to parent: "url <url>", "idle <urls received>", "load <links taken
+ * on>" and after the crawl "complete <n>", "broken <status> <url>",
+ * "edge <a> <b>", "node <a>".
+ * Parent to shard: "url <url>", "full", "stop".
+ */
+bool crawl_engine::owned(const string &url) const {
+  return shard.n_shards == 1 ||
+         (int)shard_of(url, shard.n_shards) == shard.shard_id;
+}
+
+/* queue a link routed to this shard, unless it has been seen here */
+void crawl_engine::accept_routed(crawl_job &j, const string &url) {
+  routed_in++;
+  if (j.seen.test_and_insert(url) && j.traps.admit(url)) {
+    j.lanes[in_scope(j, url.c_str()) ? CRAWL_LANE : EXTERNAL_LANE].frontier.push_back(url);
+    resolver.prefetch(url);
+  }
+}
+
+/* handle whatever the parent has sent */
+void crawl_engine::poll_router(crawl_job &j) {
+  char buf[16384];
+  ssize_t n;
+  while ((n = read(shard.router_fd, buf, sizeof buf)) > 0)
+    router_buf.append(buf, n);
+  if (n == 0)
+    router_stop = true; /* parent is gone */
+  size_t eol;
+  while ((eol = router_buf.find('\n')) != string::npos) {
+    string line = router_buf.substr(0, eol);
+    router_buf.erase(0, eol + 1);
+    if (!line.compare(0, 4, "url "))
+      accept_routed(j, line.substr(4));
+    else if (line == "full")
+      /* the other shards have used up the rest of the budget */
+      j.config.max_total =
+          std::min(j.config.max_total, j.complete + j.pending + (int)queued(j));
+    else if (line == "stop")
+      router_stop = true;
+  }
+
+  int load = j.complete + j.pending + (int)queued(j);
+  if (load != reported_load) {
+    send_line(shard.router_fd, "load " + std::to_string(load));
+    reported_load = load;
+  }
+}
+
+/* tell the parent this shard has nothing left to do, once per idle spell */
+void crawl_engine::report_idle() {
+  if (reported_idle != routed_in) {
+    send_line(shard.router_fd, "idle " + std::to_string(routed_in));
+    reported_idle = routed_in;
+  }
+}
+
+/* send this shard's results to the parent after the crawl */
+void crawl_engine::send_results(const crawl_job &j) {
+  int fd = shard.router_fd;
+  send_line(fd, "complete " + std::to_string(j.complete));
+  for (const auto &url : j.broken_links)
+    send_line(fd, "broken " + std::to_string(std::get<0>(url)) + " " +
+                      std::get<1>(url));
+  for (auto p = j.network.begin(); p != j.network.end(); p++) {
+    const auto &out = j.network.out_neighbors(p);
+    if (out.empty() && j.network.in_neighbors(p).empty())
+      send_line(fd, "node " + p->first);
+    for (const auto &to : out)
+      send_line(fd, "edge " + p->first + " " + to);
+  }
+  close(fd);
+}
+
+/*
+ * Record the outlinks of a page and queue the ones not seen before.
+ * `claimed` holds, per link, whether a parser thread already found it new
+ * (1) or seen (0) when it tested the seen set; -1 or a missing entry means
+ * the link still has to be tested here.
+ */
+size_t crawl_engine::follow_links(crawl_job &j, const std::vector<string> &links,
+                                  const char *url,
+                                  const std::vector<signed char> &claimed) {
+  if (!in_scope(j, url)) {
+    return 0;
+  }
+  return queue_links(j, links, url, claimed);
+}
+
+/* follow_links() for a page whether or not it is in scope itself */
+size_t crawl_engine::queue_links(crawl_job &j, const std::vector<string> &links,
+                                 const char *url,
+                                 const std::vector<signed char> &claimed) {
+  size_t count = 0;
+  int depth = j.config.max_depth > 0 ? depth_of(j, url) + 1 : 0;
+  for (size_t i = 0; i < links.size(); i++) {
+    const string &link = links[i];
+    bool tested = i < claimed.size() && claimed[i] >= 0;
+    bool fresh = tested ? claimed[i] == 1 : j.seen.test_and_insert(link);
+    /* the parser that tested the link has recorded its edge already */
+    if (!tested)
+      j.network.insert_edge(url, link);
+    // If link has been visited already, skip adding to queue
+    if (!fresh)
+      continue;
+
+    // Skip the redirect this host is known to answer with, keeping the
+    // same redirect edge in the graph a fetch would have produced
+    string target = j.rewrites.rewrite(link);
+    if (target != link) {
+      bool target_seen = !j.seen.test_and_insert(target);
+      j.network.insert_edge(link, target);
+      if (target_seen)
+        continue;
+    }
+
+    // Another shard's host, its owner dedupes it and checks for traps
+    if (!owned(target)) {
+      send_line(shard.router_fd, "url " + target);
+      if (count++ == j.config.max_link_per_page)
+        break;
+      continue;
+    }
+
+    // Don't spend fetches on calendars, facets and other infinite URL spaces
+    if (!j.traps.admit(target))
+      continue;
+
+    bool on_site = in_scope(j, target.c_str());
+    if (on_site && depth)
+      j.depths.emplace(target, depth);
+    if (target != link)
+      j.rewritten[target] = link;
+    j.lanes[on_site ? CRAWL_LANE : EXTERNAL_LANE].frontier.push_back(target);
+    resolver.prefetch(target);
+    if (count++ == j.config.max_link_per_page)
+      break;
+  }
+  return count;
+}
+
+void crawl_engine::finish_parse(parse_job *p) {
+  crawl_job &j = *p->job;
+  /* pages without validators are kept too, for the revisit policy */
+  if (!config.cache.empty()) {
+    page_entry e;
+    e.etag = p->etag;
+    e.last_modified = p->last_modified;
+    e.hash = p->hash;
+    e.links = p->links;
+    if (pages.update(p->url, e, time(nullptr)))
+      j.pages_changed++;
+  }
+  follow_links(j, p->links, p->base.c_str(), p->claimed);
+  if (j.callbacks.on_page)
+    j.callbacks.on_page(p->base, p->links);
+  buffers.release(p->body);
+  j.pages_parsed++;
+  delete p;
+}
+
+void crawl_engine::parse_page(parse_job *p) {
+  if (!parsers.threads()) {
+    p->hash = fingerprint(p->body);
+    p->links = extract_links(p->body, p->base.c_str());
+    finish_parse(p);
+    return;
+  }
+  p->job->parsing++;
+  parsers.submit([this, p] {
+    crawl_job &j = *p->job;
+    p->hash = fingerprint(p->body);
+    p->links = extract_links(p->body, p->base.c_str());
+    /* dedupe here, but only as many links as follow_links() may queue */
+    NGraph::tGraphBuilder<string, host_partition>::buffer edges(j.parsed_edges);
+    size_t found = 0;
+    p->claimed.assign(p->links.size(), -1);
+    for (size_t i = 0;
+         i < p->links.size() && found <= j.config.max_link_per_page; i++) {
+      p->claimed[i] = j.seen.test_and_insert(p->links[i]);
+      found += p->claimed[i];
+      edges.insert_edge(p->base, p->links[i]);
+    }
+    /* a checkpoint taken after the links are queued must see their edges */
+    edges.flush();
+    while (!parsed.try_push(p))
+      std::this_thread::yield();
+    curl_multi_wakeup(multi_handle);
+  });
+}
+
+/* record the links of pages parsed since the last call */
+void crawl_engine::drain_parsed() {
+  parse_job *jobs[64];
+  while (size_t n = parsed.pop_batch(jobs, 64)) {
+    for (size_t i = 0; i < n; i++) {
+      crawl_job *j = jobs[i]->job;
+      finish_parse(jobs[i]);
+      j->parsing--;
+    }
+  }
+}
+
+/* Pages queued from sitemaps, a sitemap counts as one page for -m */
+detached_task crawl_engine::load_sitemap(crawl_job *j, string url, int depth) {
+  job_task task(j);
+  fetch_result r = co_await fetch(j, url);
+  if (r.result != CURLE_OK || r.status != 200) {
+    string error = "Sitemap ";
+    error += url;
+    error += ": ";
+    if (r.result != CURLE_OK)
+      error += curl_easy_strerror(r.result);
+    else
+      error += "HTTP " + std::to_string(r.status);
+    notify(*j, error);
+    co_return;
+  }
+  j->sitemaps_loaded++;
+  bool index;
+  std::vector<string> locs = sitemap_locs(r.body, index);
+  if (index) {
+    /* sitemaps listed by an index are fetched concurrently, as many as
+       the crawl has budget left for */
+    int budget = j->config.max_total - (j->complete + j->pending + (int)queued(*j));
+    for (size_t i = 0; depth < 3 && (int)i < budget && i < locs.size(); i++)
+      load_sitemap(j, locs[i], depth + 1);
+    co_return;
+  }
+  /* a sitemap may live off-site (robots.txt can point anywhere), so it is
+     its entries that have to be in scope */
+  std::vector<string> on_site;
+  for (const auto &loc : locs)
+    if (in_scope(*j, loc.c_str()))
+      on_site.push_back(loc);
+  j->sitemap_links += queue_links(*j, on_site, url.c_str(), {});
+}
+
+/* seed the crawl from the sitemaps robots.txt lists, or /sitemap.xml */
+detached_task crawl_engine::discover_sitemaps(crawl_job *j, string origin) {
+  job_task task(j);
+  fetch_result r = co_await fetch(j, origin + "/robots.txt");
+  std::vector<string> sitemaps;
+  if (r.result == CURLE_OK && r.status == 200) {
+    std::istringstream lines(r.body);
+    string line;
+    while (std::getline(lines, line)) {
+      if (strncasecmp(line.c_str(), "sitemap:", 8))
+        continue;
+      size_t begin = line.find_first_not_of(" \t", 8);
+      size_t last = line.find_last_not_of(" \t\r");
+      if (begin != string::npos)
+        sitemaps.push_back(line.substr(begin, last - begin + 1));
+    }
+  }
+  if (sitemaps.empty())
+    sitemaps.push_back(origin + "/sitemap.xml");
+  for (const auto &url : sitemaps)
+    load_sitemap(j, url, 0);
+}
+
+/* returns false if the redirect chain is too long to follow */
+bool crawl_engine::follow_redirect(crawl_job &j, const string &from, const string &to) {
+  int hops = 0;
+  auto p = j.redirect_hops.find(from);
+  if (p != j.redirect_hops.end()) {
+    hops = p->second;
+    j.redirect_hops.erase(p);
+  }
+  if (hops >= max_redirects)
+    return false;
+
+  bool to_seen = !j.seen.test_and_insert(to);
+  j.network.insert_edge(from, to);
+  if (to_seen) {
+    j.redirects_deduped++;
+    return true;
+  }
+  j.redirects_followed++;
+  if (!owned(to)) {
+    send_line(shard.router_fd, "url " + to);
+  } else if (j.traps.admit(to)) {
+    j.redirect_hops[to] = hops + 1;
+    bool on_site = in_scope(j, to.c_str());
+    /* a redirect is no further from the start page than its source */
+    if (on_site && j.config.max_depth > 0)
+      j.depths.emplace(to, depth_of(j, from));
+    j.lanes[on_site ? CRAWL_LANE : EXTERNAL_LANE].frontier.push_back(to);
+    resolver.prefetch(to);
+  }
+  return true;
+}
+
+bool crawl_engine::save_checkpoint(crawl_job &j) {
+  const string &dir = j.config.checkpoint_dir;
+  mkdir(dir.c_str(), 0755);
+  string base = dir + "/";
+  merge_edges(j);
+  int committed = j.checkpoint_generation;
+  int generation = committed + 1;
+  string suffix = generation_suffix(generation);
+
+  std::ofstream graph(base + "graph" + suffix);
+  graph << j.network;
+  graph.close();
+
+  std::ofstream queue(base + "frontier" + suffix);
+  /* in-flight transfers go first so they are retried first on resume */
+  for (const transfer *t : active)
+    if (t->job == &j && !t->waiter)
+      queue << j.lanes[t->lane].name << " " << t->url << "\n";
+  for (const auto &l : j.lanes)
+    for (const auto &url : l.frontier)
+      queue << l.name << " " << url << "\n";
+  for (const auto &r : j.retry_queue)
+    queue << j.lanes[RETRY_LANE].name << " " << r.second << "\n";
+  queue.close();
+
+  std::ofstream broken(base + "broken" + suffix);
+  for (const auto &link : j.broken_links)
+    broken << std::get<0>(link) << " " << std::get<1>(link) << "\n";
+  broken.close();
+
+  std::ofstream trap_counts(base + "traps" + suffix);
+  j.traps.save(trap_counts);
+  trap_counts.close();
+
+  /* written last, renaming it into place commits the generation */
+  std::ofstream meta(base + "meta.tmp");
+  meta << "start_url " << j.start_url << "\n"
+       << "complete " << j.complete << "\n"
+       << "generation " << generation << "\n";
+  meta.close();
+
+  if (!graph || !queue || !broken || !trap_counts || !meta ||
+      std::rename((base + "meta.tmp").c_str(), (base + "meta").c_str()) != 0) {
+    remove_generation(dir, generation);
+    return false;
+  }
+  j.checkpoint_generation = generation;
+  if (committed > 0)
+    remove_generation(dir, committed);
+  return true;
+}
+
+bool crawl_engine::stopping(const crawl_job &j) const {
+  return pending_interrupt || router_stop || j.cancelled;
+}
+
+/*
+ * Revisit policy. With a revisit budget of n, only the n cached in-scope
+ * pages most likely to have changed since they were last fetched, going
+ * by their change history, are fetched again; the others are answered
+ * from the page cache as if they had not been modified. Pages that change
+ * often thus get refetched more often, and pages whose history is equally
+ * unremarkable take turns by age.
+ */
+void crawl_engine::plan_revisits(crawl_job &j) {
+  long now = time(nullptr);
+  std::vector<std::tuple<double, long, const string *> > ranked;
+  for (const auto &p : pages)
+    if (in_scope(j, p.first.c_str()))
+      ranked.push_back({-p.second.staleness(now), p.second.fetched_at, &p.first});
+  size_t n = std::min(ranked.size(), (size_t)j.config.revisit_budget);
+  std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end());
+  for (size_t i = 0; i < n; i++)
+    j.due.insert(*std::get<2>(ranked[i]));
+  j.revisits = n;
+}
+
+/* set a new job up and queue its start page; throws on bad settings */
+void crawl_engine::start_job(crawl_job &j) {
+  const crawl_config &c = j.config;
+  j.started = std::chrono::steady_clock::now();
+
+  j.start_url = c.start_url;
+  if (!c.resume_dir.empty()) {
+    if (!load_checkpoint(j))
+      throw std::runtime_error("no checkpoint found in " + c.resume_dir);
+    if (c.checkpoint_dir.empty())
+      j.config.checkpoint_dir = c.resume_dir;
+  }
+  /* carry on from the generation the checkpoint directory holds, if any */
+  if (!j.config.checkpoint_dir.empty())
+    j.checkpoint_generation = stored_generation(j.config.checkpoint_dir);
+  if (j.start_url.empty())
+    throw std::invalid_argument("no URL specified!");
+
+  j.traps.set_threshold(c.trap_threshold);
+  j.rewrites.set_threshold(c.rewrite_after);
+  j.retry_budget = c.retry_budget < 0 ? c.max_total / 10 : c.retry_budget;
+
+  /*
+   * By default off-site checks get a quarter of the slots, retries a tenth
+   * and in-scope pages the rest
+   */
+  lane *lanes = j.lanes;
+  lanes[CRAWL_LANE].max_con = c.crawl_con;
+  lanes[CRAWL_LANE].rate = c.crawl_rate;
+  lanes[EXTERNAL_LANE].max_con = c.external_con;
+  lanes[EXTERNAL_LANE].rate = c.external_rate;
+  lanes[RETRY_LANE].max_con = c.retry_con;
+  lanes[RETRY_LANE].rate = c.retry_rate;
+  if (!lanes[EXTERNAL_LANE].max_con)
+    lanes[EXTERNAL_LANE].max_con =
+        std::max(1, std::min(config.max_con, c.max_requests) / 4);
+  if (!lanes[RETRY_LANE].max_con)
+    lanes[RETRY_LANE].max_con = std::max(1, c.max_requests / 10);
+  if (!lanes[CRAWL_LANE].max_con)
+    lanes[CRAWL_LANE].max_con =
+        std::max(1, c.max_requests - lanes[EXTERNAL_LANE].max_con -
+                        lanes[RETRY_LANE].max_con);
+  for (int id = 0; id < N_LANES; id++)
+    lanes[id].bucket.configure(lanes[id].rate);
+  if (c.revisit_budget >= 0)
+    plan_revisits(j);
+
+  /* sets html start page */
+  if (!c.resume_dir.empty()) {
+    notify(j, "Resuming crawler at " + j.start_url + " with " +
+                  std::to_string(queued(j)) + " queued links . . .");
+  } else if (shard.router_fd >= 0) {
+    if (owned(j.start_url))
+      lanes[CRAWL_LANE].frontier.push_back(j.start_url);
+  } else {
+    lanes[CRAWL_LANE].frontier.push_back(j.start_url);
+    resolver.prefetch(j.start_url);
+    notify(j, "Starting crawler at " + j.start_url + " . . .");
+  }
+  if (c.sitemap && c.resume_dir.empty() && owned(j.start_url))
+    discover_sitemaps(&j, url_origin(j.start_url));
+  j.last_checkpoint = std::chrono::steady_clock::now();
+
+  /* Leave some of the time budget for writing the summary and graph */
+  j.cutoff = j.started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                             std::chrono::duration<double>(c.deadline - std::min(2.0, 0.1 * c.deadline)));
+}
+
+/*
+ * Hand the job's next URL to curl, trying its lanes in order. URLs that
+ * need no fetch on the way (cached statuses, links another crawl checked,
+ * hosts that are down) are settled as they come up. Returns false if no
+ * lane may admit anything now.
+ */
+bool crawl_engine::admit_one(crawl_job &j, long &wait_ms) {
+  int verbose = config.verbose;
+
+  /* sitemap fetches go first, they feed the crawl lane */
+  lane &crawl = j.lanes[CRAWL_LANE];
+  while (!j.fetches.empty() && !j.blocked[CRAWL_LANE] &&
+         crawl.in_flight < crawl.max_con) {
+    fetch *f = j.fetches.front();
+    host_state *host = host_of(j, f->url());
+    if (host->down()) {
+      j.fetches.pop_front();
+      f->fail(CURLE_COULDNT_CONNECT);
+      continue;
+    }
+    if (!tokens_due(j, CRAWL_LANE, wait_ms))
+      break;
+    take_tokens(j, CRAWL_LANE);
+    j.fetches.pop_front();
+    start_transfer(j, CRAWL_LANE, host, f->url(), f);
+    j.sitemap_fetches++;
+    return true;
+  }
+
+  for (int id = 0; id < N_LANES; id++) {
+    lane &l = j.lanes[id];
+    while (!j.blocked[id] && l.in_flight < l.max_con && !l.frontier.empty()) {
+      size_t next = pick_next(l);
+      const string &url = l.frontier[next];
+
+      /* off-site links checked recently, by us or another run */
+      int cached_status = id == EXTERNAL_LANE ? statuses.lookup(url) : -1;
+      if (cached_status >= 0) {
+        if (verbose > 0)
+          printf("[%d] HTTP %d (cached): %s\n", j.complete, cached_status,
+                 url.c_str());
+        if (cached_status != 200)
+          j.broken_links.push_back({cached_status, url});
+        l.completed++;
+        j.status_hits++;
+        checked(j, url, cached_status);
+        l.frontier.erase(l.frontier.begin() + next);
+        continue;
+      }
+
+      /* cached pages the revisit policy leaves for a later crawl */
+      const page_entry *cached_page = nullptr;
+      if (id == CRAWL_LANE && j.config.revisit_budget >= 0 && !j.due.count(url))
+        cached_page = pages.find(url);
+      if (cached_page) {
+        string page = url;
+        if (verbose > 0)
+          printf("[%d] Not due for a revisit: %s\n", j.complete, page.c_str());
+        l.frontier.erase(l.frontier.begin() + next);
+        l.completed++;
+        j.revisits_deferred++;
+        if (j.complete + j.pending + (int)queued(j) < j.config.max_total &&
+            below_max_depth(j, page)) {
+          follow_links(j, cached_page->links, page.c_str());
+          if (j.callbacks.on_page)
+            j.callbacks.on_page(page, cached_page->links);
+        }
+        checked(j, page, 200);
+        continue;
+      }
+
+      /* don't spend slots on hosts that are down */
+      host_state *host = host_of(j, url);
+      if (host->down()) {
+        host->skipped++;
+        j.attempts.erase(url);
+        l.frontier.erase(l.frontier.begin() + next);
+        continue;
+      }
+      if (!tokens_due(j, id, wait_ms))
+        break;
+
+      /* off-site links another crawl is checking or has checked, claimed
+         only as the transfer starts so links this crawl puts off stay
+         free for the others */
+      if (id == EXTERNAL_LANE && shared.is_open() &&
+          !shared.test_and_insert(url)) {
+        if (verbose > 0)
+          printf("[%d] Checked by another crawl: %s\n", j.complete, url.c_str());
+        j.shared_skipped.push_back(url);
+        l.frontier.erase(l.frontier.begin() + next);
+        j.shared_skips++;
+        continue;
+      }
+
+      take_tokens(j, id);
+      start_transfer(j, (lane_id)id, host, url, nullptr);
+      l.frontier.erase(l.frontier.begin() + next);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* the lane may start a transfer now, else mark it blocked until it may */
+bool crawl_engine::tokens_due(crawl_job &j, int id, long &wait_ms) {
+  double wait = std::max({j.lanes[id].bucket.wait_time(),
+                          request_bucket.wait_time(), byte_bucket.wait_time(0)});
+  if (wait > 0) {
+    /* wake up in time for the next token */
+    wait_ms = std::min(wait_ms, 1 + (long)(wait * 1000));
+    j.blocked[id] = true;
+    return false;
+  }
+  return true;
+}
+
+/* take the request tokens of a transfer the lane starts */
+void crawl_engine::take_tokens(crawl_job &j, int id) {
+  j.lanes[id].bucket.take(1);
+  request_bucket.take(1);
+}
+
+/* hand url to curl in the lane, for a fetch if waiter is set */
+void crawl_engine::start_transfer(crawl_job &j, lane_id id, host_state *host,
+                                  const string &url, fetch *waiter) {
+  long timeout_ms = host->timeout_ms(config.timeout_factor);
+  if (j.remaining_ms >= 0)
+    timeout_ms = std::min(timeout_ms, j.remaining_ms);
+  if (host->warm())
+    j.warm_admits++;
+  host->in_flight++;
+  transfer *t = new transfer{url,    string(), id,      host,
+                             nullptr, string(), nullptr, nullptr,
+                             waiter, &j,       this,    0};
+  buffers.acquire(t->body);
+  curl_multi_add_handle(
+      multi_handle,
+      make_handle(t, timeout_ms,
+                  host->connect_timeout_ms(all_connect_times,
+                                           config.timeout_factor)));
+  active.insert(t);
+  j.lanes[id].in_flight++;
+  j.pending++;
+  in_flight++;
+}
+
+/* resume the job's waiting fetches with code, including those they start */
+void crawl_engine::drop_fetches(crawl_job &j, CURLcode code) {
+  while (!j.fetches.empty()) {
+    fetch *f = j.fetches.front();
+    j.fetches.pop_front();
+    f->fail(code);
+  }
+}
+
+/* learn from a finished transfer about its host and the network */
+void crawl_engine::observe_transfer(transfer *t, CURLcode result) {
+  crawl_job &j = *t->job;
+  CURL *handle = t->handle;
+  double total_time;
+  curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total_time);
+  j.latency.add(total_time);
+
+  curl_off_t body_size;
+  curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &body_size);
+  charge_received(t, body_size);
+  long header_size;
+  curl_easy_getinfo(handle, CURLINFO_HEADER_SIZE, &header_size);
+  byte_bucket.take(header_size);
+  j.bytes_received += header_size;
+
+  long connects, http_version;
+  curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &http_version);
+  j.new_connections += connects;
+  t->host->last_done = std::chrono::steady_clock::now();
+  if (http_version >= CURL_HTTP_VERSION_2_0)
+    t->host->multiplexed = true;
+
+  double connect_time;
+  curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &connect_time);
+  if (connect_time > 0) {
+    t->host->connect_times.add(connect_time);
+    all_connect_times.add(connect_time);
+  }
+  if (result == CURLE_OK)
+    t->host->latency.add(total_time);
+  if (result == CURLE_OK || connect_time > 0) {
+    t->host->connection_ok();
+  } else if (t->host->connection_failed(result)) {
+    notify(j, "Host down, skipping its links: " + url_origin(t->url) + " (" +
+                  t->host->down_reason + ")");
+  }
+}
+
+/* give back the slots a transfer held and free it */
+void crawl_engine::end_transfer(transfer *t) {
+  crawl_job &j = *t->job;
+  t->host->in_flight--;
+  j.lanes[t->lane].in_flight--;
+  release_transfer(t);
+  j.pending--;
+  in_flight--;
+}
+
+/*
+ * A redirect rule has just been learned: apply it to the links queued
+ * before, as queue_links() does for the ones found from now on.
+ */
+void crawl_engine::rewrite_queued(crawl_job &j) {
+  std::vector<string> moved;
+  for (int id : {CRAWL_LANE, EXTERNAL_LANE}) {
+    std::deque<string> &frontier = j.lanes[id].frontier;
+    for (auto p = frontier.begin(); p != frontier.end();) {
+      const string link = *p;
+      string target = j.rewritten.count(link) ? link : j.rewrites.rewrite(link);
+      if (target == link) {
+        p++;
+        continue;
+      }
+      p = frontier.erase(p);
+      bool target_seen = !j.seen.test_and_insert(target);
+      j.network.insert_edge(link, target);
+      if (target_seen)
+        continue;
+      auto d = j.depths.find(link);
+      if (d != j.depths.end())
+        j.depths.emplace(target, d->second);
+      j.rewritten[target] = link;
+      moved.push_back(target);
+    }
+  }
+  for (const auto &target : moved)
+    j.lanes[in_scope(j, target.c_str()) ? CRAWL_LANE : EXTERNAL_LANE].frontier.push_back(target);
+}
+
+/*
+ * A rewritten URL that fails says the site doesn't follow the rule after
+ * all: disable it and fetch the link itself instead. Returns true if url
+ * was such a rewrite, and its result is to be dropped.
+ */
+bool crawl_engine::undo_rewrite(crawl_job &j, const string &url, bool ok) {
+  auto p = j.rewritten.find(url);
+  if (p == j.rewritten.end())
+    return false;
+  string link = p->second;
+  j.rewritten.erase(p);
+  if (ok)
+    return false;
+  j.rewrites.reject(link);
+  if (config.verbose > 0)
+    printf("[%d] Rewrite failed, fetching %s instead\n", j.complete, link.c_str());
+
+  /* the redirect edge was a guess, drop it with the node it added */
+  j.network.remove_edge(link, url);
+  auto v = j.network.find(url);
+  if (v != j.network.end() && j.network.in_neighbors(v).empty() &&
+      j.network.out_neighbors(v).empty())
+    j.network.remove_vertex(v);
+  auto d = j.depths.find(url);
+  if (d != j.depths.end())
+    j.depths.emplace(link, d->second);
+  j.lanes[in_scope(j, link.c_str()) ? CRAWL_LANE : EXTERNAL_LANE].frontier.push_back(link);
+  return true;
+}
+
+/* See how a lane transfer went */
+void crawl_engine::complete_transfer(transfer *t, CURLcode result) {
+  crawl_job &j = *t->job;
+  const crawl_config &c = j.config;
+  int verbose = config.verbose;
+  CURL *handle = t->handle;
+  string *mem = &t->body;
+  char *url;
+  curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url);
+  observe_transfer(t, result);
+
+  bool retried = false;
+  long res_status = 0;
+  if (result == CURLE_OK)
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &res_status);
+  if (undo_rewrite(j, t->url, result == CURLE_OK && res_status < 400)) {
+    end_transfer(t);
+    return;
+  }
+  if (result == CURLE_OK) {
+    curl_off_t retry_after;
+    curl_easy_getinfo(handle, CURLINFO_RETRY_AFTER, &retry_after);
+    char *location = nullptr;
+    if (is_redirect(res_status))
+      curl_easy_getinfo(handle, CURLINFO_REDIRECT_URL, &location);
+    else
+      j.rewrites.observe_final(t->url);
+    if (is_retryable_status(res_status) &&
+        schedule_retry(j, t->url, std::min<double>(retry_after, 60))) {
+      retried = true;
+      if (verbose > 0)
+        printf("[%d] HTTP %d, will retry: %s\n", j.complete, (int)res_status, url);
+    } else if (location) {
+      if (j.rewrites.observe_redirect(t->url, location))
+        rewrite_queued(j);
+      if (verbose > 0)
+        printf("[%d] HTTP %d: %s -> %s\n", j.complete, (int)res_status, url,
+               location);
+      if (!follow_redirect(j, t->url, location) && verbose > 0)
+        printf("[%d] Too many redirects: %s\n", j.complete, url);
+    } else if (res_status == 200) {
+      char *ctype;
+      curl_easy_getinfo(handle, CURLINFO_CONTENT_TYPE, &ctype);
+      if (verbose > 0)
+        printf("[%d] HTTP 200 (%s): %s\n", j.complete, ctype, url);
+      if (is_html(ctype) && mem->size() > 100 && in_scope(j, url) &&
+          below_max_depth(j, t->url)) {
+        if (j.complete + j.pending + (int)queued(j) < c.max_total) {
+          parse_job *p = new parse_job{&j, t->url, url, string(), t->etag, 0, 0,
+                                       std::vector<string>(),
+                                       std::vector<signed char>()};
+          p->body.swap(*mem);
+          curl_easy_getinfo(handle, CURLINFO_FILETIME, &p->last_modified);
+          parse_page(p);
+        }
+      }
+    } else if (res_status == 304 && pages.find(t->url)) {
+      /* unchanged since the last crawl, reuse its links */
+      j.not_modified++;
+      pages.revalidated(t->url, time(nullptr));
+      if (verbose > 0)
+        printf("[%d] HTTP 304: %s\n", j.complete, url);
+      if (j.complete + j.pending + (int)queued(j) < c.max_total &&
+          below_max_depth(j, t->url)) {
+        const std::vector<string> &links = pages.find(t->url)->links;
+        follow_links(j, links, url);
+        if (j.callbacks.on_page)
+          j.callbacks.on_page(url, links);
+      }
+    } else {
+      j.broken_links.push_back({(int)res_status, url});
+      if (verbose > 0)
+        printf("[%d] HTTP %d: %s\n", j.complete, (int)res_status, url);
+    }
+  } else {
+    if (result == CURLE_OPERATION_TIMEDOUT)
+      j.timed_out++;
+    if (is_retryable(result) && !t->host->tripped && schedule_retry(j, t->url)) {
+      retried = true;
+      if (verbose > 0)
+        printf("[%d] %s, will retry: %s\n", j.complete,
+               curl_easy_strerror(result), url);
+    } else if (verbose > 0) {
+      printf("[%d] Connection failure: %s\n", j.complete, url);
+    }
+  }
+  if (!retried) {
+    /* a redirect's outcome is stored under its target, and a server that
+       is overloaded now may well answer the next run */
+    if (result == CURLE_OK && !in_scope(j, t->url.c_str()) &&
+        !is_redirect(res_status) && !is_retryable_status(res_status))
+      statuses.store(t->url, res_status);
+    j.attempts.erase(t->url);
+    j.redirect_hops.erase(t->url);
+    checked(j, t->url, (int)res_status);
+  }
+  j.lanes[t->lane].completed++;
+  end_transfer(t);
+}
+
+/* save what the job leaves behind and fill in the rest of its result */
+void crawl_engine::finish_job(crawl_job &j) {
+  const crawl_config &c = j.config;
+  merge_edges(j);
+  j.interrupted = stopping(j);
+
+  /* links other crawls claimed, with the status they stored by now */
+  if (!j.shared_skipped.empty() && !config.status_cache.empty())
+    statuses.load(config.status_cache);
+  for (const auto &url : j.shared_skipped) {
+    int status = statuses.lookup(url);
+    if (status < 0) {
+      j.unchecked_links.push_back(url);
+      continue;
+    }
+    if (status != 200)
+      j.broken_links.push_back({status, url});
+    j.status_hits++;
+    checked(j, url, status);
+  }
+
+  /* interrupted transfers are saved as queued and fetched again on resume */
+  if (!c.checkpoint_dir.empty()) {
+    if (save_checkpoint(j))
+      notify(j, "Wrote checkpoint to " + c.checkpoint_dir);
+    else
+      fprintf(stderr, "Failed to write checkpoint to %s\n",
+              c.checkpoint_dir.c_str());
+  }
+
+  /* drop what an interrupt left in flight, the engine lives on */
+  for (;;) {
+    auto p = std::find_if(active.begin(), active.end(),
+                          [&j](const transfer *t) { return t->job == &j; });
+    if (p == active.end())
+      break;
+    transfer *t = *p;
+    if (t->waiter)
+      fetch::complete(t, CURLE_ABORTED_BY_CALLBACK);
+    else
+      end_transfer(t);
+  }
+  drop_fetches(j, CURLE_ABORTED_BY_CALLBACK);
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - j.started;
+  j.elapsed = elapsed.count();
+  j.queued = queued(j);
+  j.rewrites_saved = j.rewrites.saved();
+  j.suppressed = j.traps.suppressed();
+  for (const auto &l : j.lanes)
+    j.lane_stats.push_back({l.name, l.completed, l.frontier.size()});
+  for (const auto &origin : j.origins) {
+    const host_state &h = hosts[origin];
+    j.host_stats.push_back({origin, h.timeout_ms(config.timeout_factor),
+                            h.connect_timeout_ms(all_connect_times,
+                                                 config.timeout_factor),
+                            h.latency.samples(), h.tripped, h.down_reason,
+                            h.skipped});
+  }
+  j.dns_resolved = resolver.resolved();
+  j.dns_hits = resolver.hits();
+  j.buffers_reused = buffers.reused();
+  j.buffers_presized = buffers.presized();
+  j.reallocs_avoided = buffers.reallocs_avoided();
+  j.buffers_peak = buffers.peak_bytes();
+  j.parser_steals = parsers.steals();
+
+  /* keep what this crawl learned for the next one */
+  if (!config.cache.empty() && !pages.save(config.cache))
+    fprintf(stderr, "Failed to write page cache to %s\n", config.cache.c_str());
+  if (!config.status_cache.empty() && !statuses.save(config.status_cache))
+    fprintf(stderr, "Failed to write status cache to %s\n",
+            config.status_cache.c_str());
+  if (!config.dns_cache.empty() && !resolver.save(config.dns_cache))
+    fprintf(stderr, "Failed to write DNS cache to %s\n", config.dns_cache.c_str());
+
+  /* the parent prints the summary of all shards */
+  if (shard.router_fd >= 0)
+    send_results(j);
+}
+
+size_t shard_of(const string &url, int n_shards) {
+  return std::hash<string>()(url_origin(url)) % n_shards;
+}
+
+void crawl_as_shard(int n_shards, int shard_id, int router_fd) {
+  process_shard.n_shards = n_shards;
+  process_shard.shard_id = shard_id;
+  process_shard.router_fd = router_fd;
+}
+
+crawl_engine::crawl_engine(const crawler_config &settings)
+    : config(settings), shard(process_shard) {
+  int verbose = config.verbose;
+
+  if (!config.cache.empty() && pages.load(config.cache) && verbose > 0)
+    printf("Loaded %zu cached pages from %s\n", pages.size(),
+           config.cache.c_str());
+
+  statuses.set_ttl(config.status_ttl);
+  if (!config.status_cache.empty() && statuses.load(config.status_cache) &&
+      verbose > 0)
+    printf("Loaded %zu link statuses from %s\n", statuses.size(),
+           config.status_cache.c_str());
+
+  if (!config.shared_seen.empty() && !shared.open(config.shared_seen, config.status_ttl))
+    throw std::runtime_error("cannot map " + config.shared_seen);
+
+  resolver.set_ttl(config.dns_ttl);
+  if (!config.dns_cache.empty()) {
+    size_t n = resolver.load(config.dns_cache);
+    if (verbose > 0)
+      printf("Loaded %zu resolved hosts from %s\n", n, config.dns_cache.c_str());
+  }
+  resolver.start(config.dns_threads);
+
+  request_bucket.configure(config.max_rate);
+  byte_bucket.configure(config.max_bandwidth * 1e6 / 8);
+
+  LIBXML_TEST_VERSION;
+  xmlInitParser();
+  parsers.start(config.parsers);
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  multi_handle = curl_multi_init();
+  curl_multi_setopt(multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)config.max_con);
+  curl_multi_setopt(multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_con);
+  curl_multi_setopt(multi_handle, CURLMOPT_MAX_CONCURRENT_STREAMS, max_streams);
+
+  /* enables http/2 if available */
+#ifdef CURLPIPE_MULTIPLEX
+  curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+}
+
+crawl_engine::~crawl_engine() {
+  parsers.stop();
+  resolver.stop();
+  curl_multi_cleanup(multi_handle);
+  curl_global_cleanup();
+}
+
+crawl_result crawler::run(const crawl_config &config,
+                          const crawl_callbacks &callbacks) {
+  crawl_result result;
+  bool done = false;
+  crawl_callbacks own = callbacks;
+  own.on_done = [&](crawl_result &r) {
+    if (callbacks.on_done)
+      callbacks.on_done(r);
+    result = std::move(r);
+    done = true;
+  };
+  submit(config, own);
+  while (!done)
+    step();
+  return result;
+}
+
+int crawl_engine::submit(const crawl_config &config, const crawl_callbacks &callbacks) {
+  std::unique_ptr<crawl_job> j(new crawl_job());
+  j->id = ++last_job_id;
+  j->config = config;
+  j->callbacks = callbacks;
+  start_job(*j);
+  running_jobs.push_back(j.release());
+  return running_jobs.back()->id;
+}
+
+bool crawl_engine::step() {
+  /* nothing to drive or wait for */
+  if (running_jobs.empty() && watched.empty())
+    return false;
+  drain_parsed();
+  if (shard.router_fd >= 0 && !running_jobs.empty())
+    poll_router(*running_jobs.front());
+
+  /* resume paused transfers once the byte budget has recovered */
+  double byte_wait = byte_bucket.wait_time(0);
+  if (byte_wait == 0 && !paused.empty()) {
+    std::vector<CURL *> resume;
+    resume.swap(paused);
+    for (CURL *h : resume)
+      curl_easy_pause(h, CURLPAUSE_CONT);
+  }
+
+  long wait_ms = 1000;
+  auto now = std::chrono::steady_clock::now();
+  for (crawl_job *p : running_jobs) {
+    crawl_job &j = *p;
+    j.remaining_ms = -1;
+    j.admitting = !stopping(j);
+    std::fill(j.blocked, j.blocked + N_LANES, false);
+    if (j.config.deadline > 0) {
+      j.remaining_ms =
+          std::chrono::duration_cast<std::chrono::milliseconds>(j.cutoff - now).count();
+      /* Don't start transfers that would likely outlive the deadline */
+      j.admitting = j.admitting && j.remaining_ms > 0 &&
+                    j.latency.upper() * 1000 < j.remaining_ms;
+      /* past the cutoff only transfers are left, which wake curl anyway */
+      if (j.remaining_ms > 0)
+        wait_ms = std::min(wait_ms, j.remaining_ms);
+    }
+    /* sitemap fetches out of time don't hold the job open */
+    if (!j.admitting)
+      drop_fetches(j, stopping(j) ? CURLE_ABORTED_BY_CALLBACK
+                                  : CURLE_OPERATION_TIMEDOUT);
+
+    /* move retries whose backoff has expired into the retry lane */
+    while (!j.retry_queue.empty() && j.retry_queue.begin()->first <= now) {
+      j.lanes[RETRY_LANE].frontier.push_back(j.retry_queue.begin()->second);
+      j.retry_queue.erase(j.retry_queue.begin());
+    }
+  }
+
+  /* fair share of the request slots, see running_jobs */
+  int slots = config.max_requests - in_flight;
+  for (bool admitted = true; admitted && slots > 0;) {
+    admitted = false;
+    for (size_t k = 0; k < running_jobs.size() && slots > 0; k++) {
+      crawl_job &j = *running_jobs[(next_turn + k) % running_jobs.size()];
+      if (j.admitting && admit_one(j, wait_ms)) {
+        admitted = true;
+        slots--;
+      }
+    }
+  }
+  next_turn++;
+
+  bool finished = false;
+  for (size_t k = 0; k < running_jobs.size();) {
+    crawl_job &j = *running_jobs[k];
+    if (stopping(j)) {
+      /* record the links of pages still being parsed before saving anything */
+      j.done = j.parsing == 0;
+    } else if (j.pending + j.parsing + j.tasks == 0 &&
+               (!j.admitting || (!queued(j) && j.retry_queue.empty()))) {
+      j.done = shard.router_fd < 0;
+      /* other shards may still send links, wait for the parent to stop us */
+      if (!j.done)
+        report_idle();
+    }
+    if (!j.done) {
+      if (!j.retry_queue.empty())
+        wait_ms = std::min(wait_ms, 1 + (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+                                               j.retry_queue.begin()->first - now)
+                                               .count());
+      k++;
+      continue;
+    }
+    running_jobs.erase(running_jobs.begin() + k);
+    std::unique_ptr<crawl_job> owner(&j);
+    finish_job(j);
+    if (j.callbacks.on_done)
+      j.callbacks.on_done(j);
+    finished = true;
+  }
+  if (running_jobs.empty())
+    pending_interrupt = 0;
+  /* hand results back without waiting on the network */
+  if (finished)
+    return !running_jobs.empty();
+
+  if (!paused.empty())
+    wait_ms = std::min(wait_ms, 1 + (long)(byte_bucket.wait_time(0) * 1000));
+
+  int numfds, still_running;
+  /* also woken up by parsers finishing a page */
+  std::vector<struct curl_waitfd> fds;
+  if (shard.router_fd >= 0)
+    fds.push_back({shard.router_fd, CURL_WAIT_POLLIN, 0});
+  for (const auto &w : watched)
+    fds.push_back({w.first, CURL_WAIT_POLLIN, 0});
+  curl_multi_poll(multi_handle, fds.data(), fds.size(), wait_ms, &numfds);
+  curl_multi_perform(multi_handle, &still_running);
+
+  int msgs_left;
+  CURLMsg *m = NULL;
+  while ((m = curl_multi_info_read(multi_handle, &msgs_left))) {
+    if (m->msg == CURLMSG_DONE) {
+      transfer *t;
+      curl_easy_getinfo(m->easy_handle, CURLINFO_PRIVATE, &t);
+      if (t->waiter) {
+        observe_transfer(t, m->data.result);
+        fetch::complete(t, m->data.result);
+      } else {
+        complete_transfer(t, m->data.result);
+      }
+    }
+  }
+
+  for (crawl_job *p : running_jobs) {
+    crawl_job &j = *p;
+    if (!j.config.checkpoint_dir.empty() &&
+        std::chrono::steady_clock::now() - j.last_checkpoint >
+            std::chrono::duration<double>(j.config.checkpoint_interval)) {
+      /*
+       * Parsers mark the links they claim as seen before the network thread
+       * queues them, and the saved graph is the seen-set on resume. Let the
+       * pages being parsed finish so no claimed link is missing from the
+       * frontier.
+       */
+      while (j.parsing > 0) {
+        drain_parsed();
+        std::this_thread::yield();
+      }
+      if (!save_checkpoint(j))
+        fprintf(stderr, "Failed to write checkpoint to %s\n",
+                j.config.checkpoint_dir.c_str());
+      j.last_checkpoint = std::chrono::steady_clock::now();
+    }
+  }
+
+  /* callbacks may watch and unwatch descriptors, including their own */
+  for (const auto &fd : fds) {
+    auto w = watched.find(fd.fd);
+    if (fd.revents && w != watched.end()) {
+      std::function<void()> on_ready = w->second;
+      on_ready();
+    }
+  }
+  return !running_jobs.empty();
+}
+
+crawler::crawler(const crawler_config &config) {
+  if (engine_live)
+    throw std::logic_error("only one crawler may exist at a time");
+  engine_.reset(new crawl_engine(config));
+  engine_live = true;
+}
+
+crawler::~crawler() {
+  engine_->watched.clear();
+  interrupt();
+  while (jobs())
+    step();
+  engine_.reset();
+  engine_live = false;
+}
+
+int crawler::submit(const crawl_config &config, const crawl_callbacks &callbacks) {
+  return engine_->submit(config, callbacks);
+}
+
+bool crawler::step() { return engine_->step(); }
+
+size_t crawler::jobs() const { return engine_->running_jobs.size(); }
+
+void crawler::cancel(int id) {
+  for (crawl_job *j : engine_->running_jobs)
+    if (j->id == id)
+      j->cancelled = true;
+}
+
+void crawler::interrupt() { engine_->pending_interrupt = 1; }
+
+void crawler::watch(int fd, std::function<void()> on_ready) {
+  engine_->watched[fd] = on_ready;
+}
+
+void crawler::unwatch(int fd) { engine_->watched.erase(fd); }
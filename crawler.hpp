@@ -0,0 +1,216 @@
+/*
+ * Embeddable crawl engine, built as libcrawl.
+ *
+ * A crawler owns everything that is worth keeping warm between crawls: the
+ * curl multi handle and its connection cache, per-host latency and circuit
+ * breaker state, the DNS prefetcher, the parser threads and the page and
+ * status caches. run() crawls one site on it and returns its graph, broken
+ * links and counters, reporting pages and checked links through callbacks
+ * as it goes, so a long-lived process can run crawl after crawl without
+ * paying for process startup, TLS handshakes and DNS lookups again.
+ *
+ * Crawls can also run side by side: submit() starts one and step() drives
+ * all of them, handing each its result through on_done. The engine's
+ * request slots are shared fairly between the crawls in progress.
+ *
+ *   crawler_config engine;
+ *   crawler c(engine);
+ *   crawl_config job;
+ *   job.start_url = "https://example.com/";
+ *   crawl_callbacks cb;
+ *   cb.on_link = [](const std::string &url, int status) { ... };
+ *   crawl_result r = c.run(job, cb);
+ *
+ * All of that lives in the crawler object, but libcurl and libxml2 are
+ * initialized process-wide, so only one crawler may exist at a time, and
+ * it must be used from a single thread. Destroying it stops the crawls in
+ * progress; a new one can be created afterwards.
+ */
+
+#ifndef CRAWLER_H_
+#define CRAWLER_H_
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ngraph.hpp"
+
+#define crawler_version "0.0.1"
+
+/* Settings of the engine, fixed for the lifetime of a crawler */
+struct crawler_config {
+  int max_con = 200;          /* max simultaneously open connections */
+  int max_requests = 500;     /* max requests in flight, over all crawls */
+  double max_rate = 0;        /* requests per second in total, 0 = unlimited */
+  double max_bandwidth = 0;   /* Mbit/s in total, 0 = unlimited */
+  double timeout_factor = 3;  /* p99 latency multiple, 0 = fixed timeouts */
+  int dns_threads = 4;        /* 0 = let curl resolve */
+  std::string dns_cache;      /* resolved addresses, for warm starts */
+  long dns_ttl = 3600;
+  int parsers = 2;            /* 0 = parse on the network thread */
+  std::string cache;          /* validators and links of parsed pages */
+  std::string status_cache;   /* statuses of off-site links */
+  long status_ttl = 86400;
+  std::string shared_seen;    /* off-site links claimed by other crawls,
+                                 cleared after status_ttl */
+  int verbose = 0;
+};
+
+/* Settings of one crawl */
+struct crawl_config {
+  std::string start_url;      /* may be empty when resuming */
+  int max_total = 20000;      /* max requests in total */
+  int max_requests = 500;     /* max requests in flight */
+  size_t max_link_per_page = 20;
+  int max_depth = 0;          /* links from the start page to crawl, 0 = no limit */
+  int revisit_budget = -1;    /* cached pages to fetch again, -1 = all */
+  double deadline = 0;        /* seconds, 0 = no deadline */
+  int crawl_con = 0;          /* per-lane limits, 0 = derive from max_requests */
+  double crawl_rate = 0;
+  int external_con = 0;
+  double external_rate = 0;
+  int retry_con = 0;
+  double retry_rate = 0;
+  int max_retries = 2;
+  int retry_budget = -1;      /* -1 = max_total / 10 */
+  int rewrite_after = 3;
+  int trap_threshold = 0;     /* URLs per host URL pattern, 0 = no limit */
+  std::string checkpoint_dir;
+  double checkpoint_interval = 60; /* seconds */
+  std::string resume_dir;
+  bool sitemap = false;
+};
+
+struct crawl_result;
+
+/* Called on the crawler's thread from run() or step() */
+struct crawl_callbacks {
+  /* an in-scope page was parsed, or reused from the page cache */
+  std::function<void(const std::string &url, const std::vector<std::string> &links)>
+      on_page;
+  /* a link was checked: its HTTP status, or 0 if it could not be fetched */
+  std::function<void(const std::string &url, int status)> on_link;
+  /* the crawl is over; its result may be moved from */
+  std::function<void(crawl_result &result)> on_done;
+  /* a line worth showing the user: the crawl starting, a host going down,
+     a sitemap that could not be loaded, a checkpoint written */
+  std::function<void(const std::string &message)> on_message;
+};
+
+struct crawl_lane_stats {
+  const char *name;
+  int completed;
+  size_t queued;
+};
+
+struct crawl_host_stats {
+  std::string origin;
+  long timeout_ms;
+  long connect_timeout_ms;
+  int samples;
+  bool down;
+  std::string down_reason;
+  int skipped; /* links not checked while the host was down */
+};
+
+struct crawl_result {
+  std::string start_url;
+  NGraph::tGraph<std::string> network;
+  std::vector<std::tuple<int, std::string> > broken_links;
+  /* off-site links skipped for another crawl that has stored no status yet */
+  std::vector<std::string> unchecked_links;
+  int complete = 0;           /* links checked */
+  size_t queued = 0;          /* links left unchecked by a deadline or interrupt */
+  bool interrupted = false;
+  int timed_out = 0;
+  int not_modified = 0;
+  int pages_changed = 0;      /* refetched pages that differ from the cache */
+  int revisits = 0;           /* cached pages picked for a refetch */
+  int revisits_deferred = 0;  /* cached pages taken from the cache instead */
+  int status_hits = 0;
+  int shared_skips = 0;
+  long new_connections = 0;
+  int warm_admits = 0;
+  int redirects_followed = 0;
+  int redirects_deduped = 0;
+  int rewrites_saved = 0;
+  int retries = 0;
+  int retry_budget = 0;       /* left over */
+  int sitemaps_loaded = 0;
+  int sitemap_fetches = 0;
+  int sitemap_links = 0;
+  int pages_parsed = 0;
+  size_t bytes_received = 0;
+  double elapsed = 0;         /* seconds */
+  std::map<std::string, int> suppressed; /* links per crawler trap pattern */
+  std::vector<crawl_lane_stats> lane_stats;
+  std::vector<crawl_host_stats> host_stats;
+
+  /* engine totals since the crawler was created */
+  size_t dns_resolved = 0;
+  size_t dns_hits = 0;
+  size_t buffers_reused = 0;
+  size_t buffers_presized = 0;
+  size_t reallocs_avoided = 0;
+  size_t buffers_peak = 0;
+  size_t parser_steals = 0;
+};
+
+class crawl_engine;
+
+class crawler {
+public:
+  /* throws std::runtime_error if the engine cannot be set up */
+  explicit crawler(const crawler_config &config);
+  ~crawler();
+
+  crawler(const crawler &) = delete;
+  crawler &operator=(const crawler &) = delete;
+
+  /*
+   * Crawl until the frontier is empty, the budget or deadline is spent or
+   * interrupt() is called. Throws std::invalid_argument without a start
+   * URL and std::runtime_error if resume_dir holds no checkpoint.
+   */
+  crawl_result run(const crawl_config &config,
+                   const crawl_callbacks &callbacks = crawl_callbacks());
+
+  /*
+   * Start a crawl alongside the others and return its id; it progresses
+   * as step() is called. Throws like run().
+   */
+  int submit(const crawl_config &config, const crawl_callbacks &callbacks);
+
+  /*
+   * One round of the network loop for all crawls in progress, waiting up
+   * to a second for something to happen. Returns false once none is left.
+   */
+  bool step();
+
+  /* crawls in progress */
+  size_t jobs() const;
+
+  /* stop one crawl, which then finishes like an interrupted one */
+  void cancel(int id);
+
+  /* stop all crawls in progress; safe to call from a signal handler */
+  void interrupt();
+
+  /*
+   * Call on_ready from step() whenever fd is readable, so a server can
+   * accept clients without stalling the crawls.
+   */
+  void watch(int fd, std::function<void()> on_ready);
+  void unwatch(int fd);
+
+private:
+  std::unique_ptr<crawl_engine> engine_;
+};
+
+#endif
+// CRAWLER_H_
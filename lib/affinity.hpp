@@ -0,0 +1,35 @@
+/*
+ * Connection affinity for admission queues.
+ *
+ * Admitting a URL whose host already has an open connection with room for
+ * another transfer saves a TCP and TLS handshake, so the next URL to admit
+ * is the first one within `window` of the head whose host is warm, else
+ * the head. Passing over the head is counted in `skips`, and the head is
+ * taken anyway once it has been passed over `window` times in a row, so
+ * URLs of cold hosts wait a bounded number of admissions.
+ */
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+#include <algorithm>
+#include <cstddef>
+
+/* index into queue of the next URL to admit; warm(url) says if its host is */
+template <typename Queue, typename Warm>
+size_t pick_warm(const Queue &queue, size_t window, size_t &skips, Warm warm) {
+  if (skips < window) {
+    size_t n = std::min(queue.size(), window);
+    for (size_t i = 0; i < n; i++) {
+      if (warm(queue[i])) {
+        skips = i ? skips + 1 : 0;
+        return i;
+      }
+    }
+  }
+  skips = 0;
+  return 0;
+}
+
+#endif
+// AFFINITY_H_
@@ -0,0 +1,118 @@
+/*
+ * Pool of reusable response body buffers.
+ *
+ * A transfer takes a buffer that earlier transfers have already grown, so
+ * most bodies are received without any reallocation; when the response
+ * announces its Content-Length the buffer is reserved to that size up
+ * front. Buffers stay contiguous since the HTML parser needs the whole page
+ * in one piece. Idle buffers are capped in number and size so one huge page
+ * does not pin its memory for the rest of the crawl.
+ */
+
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+class buffer_pool {
+public:
+  explicit buffer_pool(size_t max_idle = 64, size_t max_keep = 4 << 20)
+      : max_idle_(max_idle), max_keep_(max_keep), bytes_(0), peak_(0),
+        reused_(0), presized_(0), grows_(0), naive_grows_(0) {}
+
+  /* swap a pooled buffer into buf, which must be empty */
+  void acquire(std::string &buf) {
+    if (idle_.empty())
+      return;
+    buf.swap(idle_.back());
+    idle_.pop_back();
+    reused_++;
+  }
+
+  /* reserve room for an announced body size */
+  void presize(std::string &buf, size_t n) {
+    if (n > max_presize)
+      n = max_presize;
+    if (n <= buf.capacity())
+      return;
+    size_t before = buf.capacity();
+    buf.reserve(n);
+    account(before, buf.capacity());
+    presized_++;
+    grows_++;
+  }
+
+  void append(std::string &buf, const char *data, size_t n) {
+    size_t before = buf.capacity();
+    buf.append(data, n);
+    if (buf.capacity() != before) {
+      grows_++;
+      account(before, buf.capacity());
+    }
+  }
+
+  /*
+   * return buf to the pool, leaving it empty. A buffer whose storage was
+   * handed off with swap() has nothing to return and is ignored.
+   */
+  void release(std::string &buf) {
+    if (!heap(buf.capacity()))
+      return;
+    naive_grows_ += growths(buf.size());
+    buf.clear();
+    if (idle_.size() < max_idle_ && buf.capacity() <= max_keep_) {
+      idle_.push_back(std::string());
+      idle_.back().swap(buf);
+    } else {
+      account(buf.capacity(), 0);
+      std::string().swap(buf);
+    }
+  }
+
+  /* buf is about to leave for good, stop counting its memory */
+  void detach(const std::string &buf) { account(buf.capacity(), 0); }
+
+  size_t reused() const { return reused_; }
+  size_t presized() const { return presized_; }
+  size_t peak_bytes() const { return peak_; }
+
+  /* reallocations a fresh, geometrically growing buffer per body would do */
+  size_t reallocs_avoided() const {
+    return naive_grows_ > grows_ ? naive_grows_ - grows_ : 0;
+  }
+
+private:
+  static const size_t max_presize = 64 << 20;
+
+  static size_t heap(size_t capacity) {
+    return capacity > std::string().capacity() ? capacity : 0;
+  }
+
+  static size_t growths(size_t n) {
+    size_t count = 0;
+    for (size_t capacity = std::string().capacity(); capacity < n; capacity *= 2)
+      count++;
+    return count;
+  }
+
+  void account(size_t before, size_t after) {
+    bytes_ += heap(after);
+    bytes_ -= heap(before);
+    peak_ = std::max(peak_, bytes_);
+  }
+
+  size_t max_idle_;
+  size_t max_keep_;
+  size_t bytes_;
+  size_t peak_;
+  size_t reused_;
+  size_t presized_;
+  size_t grows_;
+  size_t naive_grows_;
+  std::vector<std::string> idle_;
+};
+
+#endif
+// BUFFER_POOL_H_
@@ -0,0 +1,28 @@
+/*
+ * Minimal coroutine support for crawl pipelines.
+ *
+ * A detached_task starts running as soon as it is called and frees itself
+ * when it finishes; nobody awaits it, so whoever starts tasks has to count
+ * the ones still alive to know when its pipelines are done. Tasks are meant
+ * to be started and resumed on the network thread only.
+ */
+
+#ifndef CORO_H_
+#define CORO_H_
+
+#include <coroutine>
+#include <exception>
+
+class detached_task {
+public:
+  struct promise_type {
+    detached_task get_return_object() { return detached_task(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+#endif
+// CORO_H_
@@ -0,0 +1,251 @@
+/*
+ * Background DNS prefetching with an optional persistent cache.
+ *
+ * Hosts are queued as soon as links to them are discovered and resolved
+ * with getaddrinfo() on a small pool of threads, off the network loop's
+ * critical path. Resolved addresses are handed to curl through
+ * CURLOPT_RESOLVE, and can be saved so the next run starts warm. Addresses
+ * older than the ttl are resolved again, and failed lookups are retried
+ * after a minute.
+ */
+
+#ifndef DNS_PREFETCHER_H_
+#define DNS_PREFETCHER_H_
+
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+class dns_prefetcher {
+public:
+  explicit dns_prefetcher(long ttl = 3600) : ttl_(ttl), stop_(false) {}
+
+  ~dns_prefetcher() { stop(); }
+
+  void set_ttl(long ttl) { ttl_ = ttl; }
+
+  /* a stopped prefetcher may be started again */
+  void start(int n_threads) {
+    stop_ = false;
+    /* hosts left queued by stop() get queued again by the next prefetch */
+    for (const auto &key : queue_)
+      entries_.erase(key);
+    queue_.clear();
+    for (int i = 0; i < n_threads; i++)
+      workers_.emplace_back([this] { run(); });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    for (auto &w : workers_)
+      w.join();
+    workers_.clear();
+  }
+
+  /* queue "host:port" for resolution unless it is fresh or pending */
+  void prefetch(const std::string &url) {
+    std::string key;
+    if (workers_.empty() || !host_port(url, key))
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!queue_locked(key))
+        return;
+    }
+    cond_.notify_one();
+  }
+
+  /*
+   * CURLOPT_RESOLVE entry for the url's host with all its addresses, or ""
+   * if it is not resolved or its addresses are older than the ttl
+   */
+  std::string resolve_entry(const std::string &url) {
+    std::string key;
+    if (!host_port(url, key))
+      return std::string();
+    bool queued = false;
+    std::string resolved;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto p = entries_.find(key);
+      if (p != entries_.end() && !p->second.addr.empty() &&
+          !stale(p->second)) {
+        hits_++;
+        resolved = "+" + key + ":" + p->second.addr;
+      } else if (p != entries_.end() && !workers_.empty()) {
+        queued = queue_locked(key);
+      }
+    }
+    if (queued)
+      cond_.notify_one();
+    return resolved;
+  }
+
+  /* "host:port addr resolved_at" lines, dropping entries older than ttl */
+  size_t load(const std::string &path) {
+    std::ifstream s(path);
+    std::string key, addr;
+    long resolved_at;
+    size_t n = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (s >> key >> addr >> resolved_at) {
+      if (std::time(nullptr) - resolved_at > ttl_)
+        continue;
+      entries_[key] = entry{addr, resolved_at, false};
+      n++;
+    }
+    return n;
+  }
+
+  bool save(const std::string &path) {
+    std::string tmp = path + ".tmp";
+    std::ofstream s(tmp);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto &e : entries_)
+        if (!e.second.addr.empty())
+          s << e.first << " " << e.second.addr << " " << e.second.resolved_at
+            << "\n";
+    }
+    s.close();
+    return s && std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  size_t resolved() const { return resolved_; }
+  size_t hits() const { return hits_; }
+
+private:
+  /* seconds before a failed lookup is tried again */
+  static const long retry_after = 60;
+
+  struct entry {
+    std::string addr; /* comma separated, "" if the lookup failed */
+    long resolved_at;
+    bool pending;
+  };
+
+  bool stale(const entry &e) const {
+    long age = std::time(nullptr) - e.resolved_at;
+    return e.addr.empty() ? age >= retry_after : age > ttl_;
+  }
+
+  /* queue key unless it is pending or fresh, with mutex_ held */
+  bool queue_locked(const std::string &key) {
+    auto p = entries_.find(key);
+    if (p != entries_.end() && (p->second.pending || !stale(p->second)))
+      return false;
+    entry &e = entries_[key];
+    if (p == entries_.end())
+      e = entry{std::string(), 0, false};
+    e.pending = true;
+    queue_.push_back(key);
+    return true;
+  }
+
+  /* "host:port" of an http(s) url with a host name (not an address) */
+  static bool host_port(const std::string &url, std::string &key) {
+    size_t p = url.find("://");
+    if (p == std::string::npos)
+      return false;
+    std::string scheme = url.substr(0, p);
+    size_t start = p + 3;
+    std::string authority =
+        url.substr(start, url.find_first_of("/?#", start) - start);
+    if (authority.empty() || authority[0] == '[' ||
+        authority.find('@') != std::string::npos)
+      return false;
+    size_t colon = authority.find(':');
+    std::string host = authority.substr(0, colon);
+    if (host.find_first_not_of("0123456789.") == std::string::npos)
+      return false;
+    std::string port = colon != std::string::npos ? authority.substr(colon + 1)
+                       : scheme == "https"        ? "443"
+                                                  : "80";
+    key = host + ":" + port;
+    return true;
+  }
+
+  void run() {
+    for (;;) {
+      std::string key;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (stop_)
+          return;
+        key = queue_.front();
+        queue_.pop_front();
+      }
+
+      size_t colon = key.rfind(':');
+      std::string host = key.substr(0, colon);
+      std::string port = key.substr(colon + 1);
+      struct addrinfo hints, *res = nullptr;
+      std::memset(&hints, 0, sizeof hints);
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      /* all of them, so curl can fall back to the next one */
+      std::vector<std::string> addrs;
+      if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) == 0) {
+        for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+          char buf[INET6_ADDRSTRLEN];
+          std::string addr;
+          if (ai->ai_family == AF_INET &&
+              inet_ntop(AF_INET, &((sockaddr_in *)ai->ai_addr)->sin_addr, buf,
+                        sizeof buf))
+            addr = buf;
+          else if (ai->ai_family == AF_INET6 &&
+                   inet_ntop(AF_INET6, &((sockaddr_in6 *)ai->ai_addr)->sin6_addr,
+                             buf, sizeof buf))
+            addr = "[" + std::string(buf) + "]";
+          if (!addr.empty() &&
+              std::find(addrs.begin(), addrs.end(), addr) == addrs.end())
+            addrs.push_back(addr);
+        }
+        freeaddrinfo(res);
+      }
+      std::string addr;
+      for (const auto &a : addrs) {
+        if (!addr.empty())
+          addr += ',';
+        addr += a;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      entries_[key] = entry{addr, (long)std::time(nullptr), false};
+      if (!addr.empty())
+        resolved_++;
+    }
+  }
+
+  long ttl_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::string> queue_;
+  std::map<std::string, entry> entries_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> resolved_{0};
+  std::atomic<size_t> hits_{0};
+};
+
+#endif
+// DNS_PREFETCHER_H_
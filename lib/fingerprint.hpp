@@ -0,0 +1,22 @@
+/*
+ * 64-bit FNV-1a fingerprint of a URL, used as a compact key wherever URLs
+ * are stored in bulk or shared with other processes.
+ */
+
+#ifndef FINGERPRINT_H_
+#define FINGERPRINT_H_
+
+#include <cstdint>
+#include <string>
+
+inline uint64_t fingerprint(const std::string &s) {
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+#endif
+// FINGERPRINT_H_
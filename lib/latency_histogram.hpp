@@ -0,0 +1,73 @@
+/*
+ * Streaming latency histogram with log-spaced buckets.
+ *
+ * Bucket i covers latencies up to 1ms * 1.25^i, so 50 buckets span 1ms to
+ * about 56s with at most 25% relative error on quantiles; slower samples
+ * count towards the last bucket. Counts are halved once `max_samples` have
+ * been recorded, so old samples decay and the quantiles follow a host whose
+ * latency changes over a long crawl.
+ *
+ * timeout_ms() turns the histogram into a timeout: p99 times a safety
+ * factor, clamped to a range, or a fixed value until there are enough
+ * samples to go by.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cmath>
+
+class latency_histogram {
+public:
+  static const int n_buckets = 50;
+  static const int max_samples = 1000;
+  static const int min_samples = 10; /* before timeout_ms() trusts p99 */
+
+  latency_histogram() : samples_(0) {
+    for (int i = 0; i < n_buckets; i++)
+      counts_[i] = 0;
+  }
+
+  void add(double secs) {
+    double ms = secs * 1000;
+    int i = ms <= 1 ? 0 : (int)std::ceil(std::log(ms) / std::log(1.25));
+    counts_[i < n_buckets ? i : n_buckets - 1]++;
+    if (++samples_ >= max_samples) {
+      samples_ = 0;
+      for (int j = 0; j < n_buckets; j++) {
+        counts_[j] /= 2;
+        samples_ += counts_[j];
+      }
+    }
+  }
+
+  int samples() const { return samples_; }
+
+  /* upper bound in seconds of the bucket holding quantile q */
+  double quantile(double q) const {
+    int target = (int)std::ceil(q * samples_);
+    int seen = 0;
+    for (int i = 0; i < n_buckets; i++) {
+      seen += counts_[i];
+      if (seen >= target && seen > 0)
+        return std::pow(1.25, i) / 1000;
+    }
+    return std::pow(1.25, n_buckets - 1) / 1000;
+  }
+
+  /* p99 * factor in ms within [lo, hi], or fixed with too few samples */
+  long timeout_ms(double factor, long fixed, long lo, long hi) const {
+    if (factor <= 0 || samples_ < min_samples)
+      return fixed;
+    long ms = (long)(quantile(0.99) * factor * 1000);
+    return std::max(lo, std::min(hi, ms));
+  }
+
+private:
+  int counts_[n_buckets];
+  int samples_;
+};
+
+#endif
+// LATENCY_HISTOGRAM_H_
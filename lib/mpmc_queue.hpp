@@ -0,0 +1,127 @@
+/*
+ * Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * A ring of cells, each tagged with a sequence number that says whether
+ * the cell is ready to be written or read at a given position (Vyukov's
+ * bounded MPMC queue). Producers and consumers each claim positions with a
+ * compare-and-swap on their own counter, so they only contend with their
+ * own kind. The batch operations claim a run of ready cells with a single
+ * compare-and-swap, which is what keeps the queue cheap under heavy
+ * contention.
+ */
+
+#ifndef MPMC_QUEUE_H_
+#define MPMC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+template <typename T> class mpmc_queue {
+public:
+  /* capacity is rounded up to a power of two */
+  explicit mpmc_queue(size_t capacity = 1024) {
+    size_t n = 2;
+    while (n < capacity)
+      n *= 2;
+    mask_ = n - 1;
+    cells_.reset(new cell[n]);
+    for (size_t i = 0; i < n; i++)
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  /* false if the queue is full */
+  bool try_push(const T &value) { return push_batch(&value, 1) == 1; }
+
+  /* false if the queue is empty */
+  bool try_pop(T &value) { return pop_batch(&value, 1) == 1; }
+
+  /* push up to n values, returns how many were pushed */
+  size_t push_batch(const T *values, size_t n) {
+    if (n == 0)
+      return 0;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t k;
+    for (;;) {
+      k = ready(pos, n, 0);
+      if (k == 0) {
+        intptr_t diff = (intptr_t)seq(pos) - (intptr_t)pos;
+        if (diff < 0)
+          return 0;
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + k,
+                                             std::memory_order_relaxed))
+        break;
+    }
+    for (size_t i = 0; i < k; i++) {
+      cell &c = cells_[(pos + i) & mask_];
+      c.value = values[i];
+      c.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return k;
+  }
+
+  /* pop up to n values into out, returns how many were popped */
+  size_t pop_batch(T *out, size_t n) {
+    if (n == 0)
+      return 0;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    size_t k;
+    for (;;) {
+      k = ready(pos, n, 1);
+      if (k == 0) {
+        intptr_t diff = (intptr_t)seq(pos) - (intptr_t)(pos + 1);
+        if (diff < 0)
+          return 0;
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (dequeue_pos_.compare_exchange_weak(pos, pos + k,
+                                             std::memory_order_relaxed))
+        break;
+    }
+    for (size_t i = 0; i < k; i++) {
+      cell &c = cells_[(pos + i) & mask_];
+      out[i] = c.value;
+      c.seq.store(pos + i + mask_ + 1, std::memory_order_release);
+    }
+    return k;
+  }
+
+private:
+  struct cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  size_t seq(size_t pos) const {
+    return cells_[pos & mask_].seq.load(std::memory_order_acquire);
+  }
+
+  /* length of the run of cells from pos with sequence pos + i + offset */
+  size_t ready(size_t pos, size_t n, size_t offset) const {
+    size_t k = 0;
+    while (k < n && k <= mask_ && seq(pos + k) == pos + k + offset)
+      k++;
+    return k;
+  }
+
+  /* keep the two counters on separate cache lines */
+  char pad0_[64];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[64];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[64];
+  size_t mask_;
+  std::unique_ptr<cell[]> cells_;
+};
+
+#endif
+// MPMC_QUEUE_H_
@@ -22,6 +22,8 @@
 
 // version 4.2
 // 2020-12-28: Added to_graphviz (nhl0819@gmail.com)
+// 2026-10-16: Added tGraphBuilder for concurrent edge ingestion
+// 2026-10-16: Added move construction and assignment
 
 
 #include <iostream>
@@ -33,6 +35,9 @@
 #include <string>
 #include <algorithm>
 #include <sstream>      // for I/O << and >> operators
+#include <functional>   // for std::hash
+#include <memory>
+#include <mutex>        // for tGraphBuilder
 //#include "set_ops.hpp"
 
 
@@ -178,6 +183,18 @@ class tGraph
 
     tGraph(const tGraph &B) : G_(B.G_), num_edges_(B.num_edges_), 
           undirected_(B.undirected_){}
+    tGraph(tGraph &&B) : G_(std::move(B.G_)), num_edges_(B.num_edges_),
+          undirected_(B.undirected_){ B.num_edges_ = 0; }
+    tGraph &operator=(const tGraph &B) = default;
+    tGraph &operator=(tGraph &&B)
+    {
+      G_ = std::move(B.G_);
+      num_edges_ = B.num_edges_;
+      undirected_ = B.undirected_;
+      B.G_.clear();
+      B.num_edges_ = 0;
+      return *this;
+    }
     tGraph(const edge_set &E)
     {
       for (typename edge_set::const_iterator p = E.begin(); 
@@ -1097,6 +1114,132 @@ void tGraph<T>::to_graphviz(FILE *fptr) const {
   fputs(ss.str().c_str(), fptr);
 }
 
+
+// CONCURRENT GRAPH BUILDER
+//
+//  tGraph is not thread-safe. tGraphBuilder collects edges from several
+//  threads: each thread owns a tGraphBuilder::buffer, which keeps edges
+//  locally and flushes them in sorted batches into partitions chosen by
+//  Partition()(source vertex), each behind its own lock. Threads only
+//  contend when flushing into the same partition at the same time.
+//  build() then moves everything collected so far into a normal tGraph.
+//
+//  The default partition is by vertex hash; a crawler would rather pass
+//  a functor that hashes the host of a URL, keeping a site together.
+//
+/**
+
+   Example:
+
+<pre>
+    tGraphBuilder<std::string> B;
+
+    // in each thread
+    tGraphBuilder<std::string>::buffer local(B);
+    local.insert_edge(a, b);
+    local.flush();
+
+    // once the threads are done
+    sGraph G = B.build();
+</pre>
+
+*/
+template <typename T, typename Partition = std::hash<T> >
+class tGraphBuilder
+{
+  public:
+
+    typedef std::pair<T, T> edge;
+
+    class buffer
+    {
+      public:
+
+        explicit buffer(tGraphBuilder &B, size_t batch_size = 1024) :
+            B_(B), batch_size_(batch_size) {}
+
+        ~buffer() { flush(); }
+
+        void insert_edge(const T &a, const T &b)
+        {
+            E_.push_back(edge(a, b));
+            if (E_.size() >= batch_size_)
+              flush();
+        }
+
+        void flush()
+        {
+            if (E_.empty())
+              return;
+            // group by partition, each group in edge order
+            std::vector<std::pair<size_t, edge> > sorted;
+            sorted.reserve(E_.size());
+            for (typename std::vector<edge>::iterator p = E_.begin();
+                        p != E_.end(); p++)
+              sorted.push_back(std::make_pair(B_.partition_of(p->first), *p));
+            std::sort(sorted.begin(), sorted.end());
+            E_.clear();
+
+            for (size_t i = 0; i < sorted.size(); )
+            {
+                size_t k = sorted[i].first;
+                typename tGraphBuilder::partition &P = B_.partitions_[k];
+                std::lock_guard<std::mutex> lock(P.mutex);
+                typename std::set<edge>::iterator hint = P.E.end();
+                for ( ; i < sorted.size() && sorted[i].first == k; i++)
+                  hint = P.E.insert(hint, sorted[i].second);
+            }
+        }
+
+      private:
+
+        tGraphBuilder &B_;
+        size_t batch_size_;
+        std::vector<edge> E_;
+    };
+
+    explicit tGraphBuilder(unsigned int num_partitions = 16) :
+        n_(num_partitions), partitions_(new partition[num_partitions]) {}
+
+    unsigned int num_partitions() const { return n_; }
+
+    // move the edges flushed so far into G, leaving the partitions empty
+    void build(tGraph<T> &G)
+    {
+        for (unsigned int k = 0; k < n_; k++)
+        {
+            std::set<edge> E;
+            {
+                std::lock_guard<std::mutex> lock(partitions_[k].mutex);
+                E.swap(partitions_[k].E);
+            }
+            for (typename std::set<edge>::const_iterator p = E.begin();
+                        p != E.end(); p++)
+              G.insert_edge(*p);
+        }
+    }
+
+    tGraph<T> build()
+    {
+        tGraph<T> G;
+        build(G);
+        return G;
+    }
+
+  private:
+
+    struct partition
+    {
+        std::mutex mutex;
+        std::set<edge> E;
+    };
+
+    size_t partition_of(const T &a) const { return Partition()(a) % n_; }
+
+    unsigned int n_;
+    std::unique_ptr<partition[]> partitions_;
+};
+
 }
 // namespace NGraph
 
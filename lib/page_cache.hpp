@@ -0,0 +1,169 @@
+/*
+ * Persistent per-URL cache of validators, extracted outlinks and change
+ * history.
+ *
+ * A page whose ETag or Last-Modified is known can be revalidated with a
+ * conditional request; on 304 Not Modified its outlinks are taken from the
+ * cache instead of downloading and parsing it again.
+ *
+ * Every fetch of a cached page is also an observation of whether it changed
+ * since the previous one, by its content hash or else its validators. From
+ * those, change_rate() estimates how often the page changes, so a crawl on
+ * a fixed budget can refetch the pages most likely to be stale and take the
+ * others from the cache.
+ *
+ * The file holds one record per page, a tab separated header line
+ * "<url> <last-modified> <link count> <hash> <fetched at> <intervals>
+ * <changes> <observed> <etag>" followed by one link per line.
+ */
+
+#ifndef PAGE_CACHE_H_
+#define PAGE_CACHE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct page_entry {
+  std::string etag;
+  long last_modified = -1; /* seconds since the epoch, -1 = unknown */
+  std::vector<std::string> links;
+
+  /* change history, see visited() */
+  uint64_t hash = 0;   /* fingerprint of the body, 0 = unknown */
+  long fetched_at = 0; /* seconds since the epoch, 0 = never */
+  int intervals = 0;   /* between two fetches */
+  int changes = 0;     /* intervals in which the page changed */
+  long observed = 0;   /* seconds covered by those intervals */
+
+  /* a fetch at `now` found the page changed since the previous one, or not */
+  void visited(bool changed, long now) {
+    if (fetched_at > 0 && now > fetched_at) {
+      intervals++;
+      changes += changed;
+      observed += now - fetched_at;
+    }
+    fetched_at = now;
+  }
+
+  /*
+   * Changes per second, or -1 before the page has been fetched twice. Only
+   * whether a page changed between fetches is known, not how often, so
+   * this is Cho and Garcia-Molina's estimator -log((n - X + 0.5) / (n + 0.5))
+   * changes per mean interval for X changes in n intervals, which unlike
+   * X / n does not saturate when the page changed at every fetch.
+   */
+  double change_rate() const {
+    if (intervals == 0 || observed <= 0)
+      return -1;
+    double n = intervals;
+    return -std::log((n - changes + 0.5) / (n + 0.5)) * n / observed;
+  }
+
+  /* probability the page has changed since it was fetched, 1 if unknown */
+  double staleness(long now) const {
+    double rate = change_rate();
+    if (rate < 0)
+      return 1;
+    return 1 - std::exp(-rate * std::max(0L, now - fetched_at));
+  }
+};
+
+class page_cache {
+public:
+  typedef std::map<std::string, page_entry>::const_iterator const_iterator;
+
+  bool load(const std::string &path) {
+    std::ifstream s(path);
+    if (!s)
+      return false;
+    std::string line, link;
+    while (std::getline(s, line)) {
+      std::vector<std::string> f;
+      std::istringstream fields(line);
+      for (std::string value; std::getline(fields, value, '\t');)
+        f.push_back(value);
+      if (!line.empty() && line.back() == '\t')
+        f.push_back(""); /* no etag */
+      if (f.size() != 9)
+        break;
+      page_entry &e = pages_[f[0]];
+      e.last_modified = std::stol(f[1]);
+      e.hash = std::stoull(f[3]);
+      e.fetched_at = std::stol(f[4]);
+      e.intervals = std::stoi(f[5]);
+      e.changes = std::stoi(f[6]);
+      e.observed = std::stol(f[7]);
+      e.etag = f[8];
+      e.links.clear();
+      for (long n = std::stol(f[2]); n > 0 && std::getline(s, link); n--)
+        e.links.push_back(link);
+    }
+    return true;
+  }
+
+  bool save(const std::string &path) const {
+    std::string tmp = path + ".tmp";
+    std::ofstream s(tmp);
+    for (const auto &p : pages_) {
+      const page_entry &e = p.second;
+      s << p.first << "\t" << e.last_modified << "\t" << e.links.size() << "\t"
+        << e.hash << "\t" << e.fetched_at << "\t" << e.intervals << "\t"
+        << e.changes << "\t" << e.observed << "\t" << e.etag << "\n";
+      for (const auto &link : e.links)
+        s << link << "\n";
+    }
+    s.close();
+    return s && std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  const page_entry *find(const std::string &url) const {
+    auto p = pages_.find(url);
+    return p == pages_.end() ? nullptr : &p->second;
+  }
+
+  /*
+   * Store a page downloaded at `now`, carrying its change history over.
+   * Returns true if it changed since it was cached.
+   */
+  bool update(const std::string &url, page_entry e, long now) {
+    bool changed = false;
+    auto p = pages_.find(url);
+    if (p != pages_.end()) {
+      const page_entry &old = p->second;
+      changed = old.hash && e.hash ? old.hash != e.hash
+                                   : old.etag != e.etag ||
+                                         old.last_modified != e.last_modified;
+      e.fetched_at = old.fetched_at;
+      e.intervals = old.intervals;
+      e.changes = old.changes;
+      e.observed = old.observed;
+    }
+    e.visited(changed, now);
+    pages_[url] = e;
+    return changed;
+  }
+
+  /* a conditional request at `now` found url not modified */
+  void revalidated(const std::string &url, long now) {
+    auto p = pages_.find(url);
+    if (p != pages_.end())
+      p->second.visited(false, now);
+  }
+
+  const_iterator begin() const { return pages_.begin(); }
+  const_iterator end() const { return pages_.end(); }
+  size_t size() const { return pages_.size(); }
+
+private:
+  std::map<std::string, page_entry> pages_;
+};
+
+#endif
+// PAGE_CACHE_H_
@@ -0,0 +1,205 @@
+/*
+ * Host-wide redirect rules learned from observed redirects.
+ *
+ * Many sites redirect every http:// URL to https://, add or strip a "www."
+ * prefix, or add a trailing slash to directory-like paths. After
+ * `threshold` redirects from one origin that are fully explained by such a
+ * rule, and none that contradict it, matching URLs are rewritten before
+ * they are fetched, saving a round trip each. A response that is not a
+ * redirect on a URL the rule covers, or a failed fetch of a rewritten URL,
+ * disables the rule for good.
+ */
+
+#ifndef REWRITE_RULES_H_
+#define REWRITE_RULES_H_
+
+#include <map>
+#include <string>
+
+class rewrite_rules {
+public:
+  explicit rewrite_rules(int threshold = 3) : threshold_(threshold), saved_(0) {}
+
+  void set_threshold(int threshold) { threshold_ = threshold; }
+
+  /* number of URLs rewritten, i.e. redirect round trips saved */
+  int saved() const { return saved_; }
+
+  /*
+   * learn from a redirect of `from` to `to`, returns true if that makes a
+   * rule active, so URLs queued before can be rewritten too
+   */
+  bool observe_redirect(const std::string &from, const std::string &to) {
+    url a, b;
+    if (threshold_ <= 0 || !a.parse(from) || !b.parse(to))
+      return false;
+    host_rules &r = rules_[a.origin()];
+    bool upgrade = a.scheme == "http" && b.scheme == "https";
+    if (!upgrade && a.scheme != b.scheme)
+      return false;
+
+    int www = 0;
+    if (b.host == "www." + a.host)
+      www = 1;
+    else if (a.host == "www." + b.host)
+      www = -1;
+    else if (a.host != b.host)
+      return false;
+
+    bool slash = b.path == a.path + "/";
+    if (!slash && b.path != a.path)
+      return false;
+    if (a.port != b.port || a.rest != b.rest)
+      return false;
+
+    bool learned = false;
+    if (upgrade)
+      learned |= learn(r.upgrade);
+    if (www > 0)
+      learned |= learn(r.add_www);
+    if (www < 0)
+      learned |= learn(r.strip_www);
+    if (slash && slash_candidate(a))
+      learned |= learn(r.add_slash);
+    return learned;
+  }
+
+  /* a response other than a redirect for `u` */
+  void observe_final(const std::string &u) {
+    url a;
+    if (threshold_ <= 0 || !a.parse(u))
+      return;
+    auto p = rules_.find(a.origin());
+    if (p == rules_.end())
+      return;
+    host_rules &r = p->second;
+    r.upgrade = r.add_www = r.strip_www = disabled;
+    if (slash_candidate(a))
+      r.add_slash = disabled;
+  }
+
+  /* url with all learned rules applied */
+  std::string rewrite(const std::string &u) {
+    url a;
+    if (threshold_ <= 0 || !a.parse(u) || !apply(a, false))
+      return u;
+    saved_++;
+    return a.str();
+  }
+
+  /*
+   * fetching the rewrite() of `u` failed: it saved no round trip, and the
+   * rules that made it are disabled
+   */
+  void reject(const std::string &u) {
+    url a;
+    if (threshold_ <= 0 || !a.parse(u))
+      return;
+    apply(a, true);
+    saved_--;
+  }
+
+private:
+  static const int disabled = -1;
+
+  struct host_rules {
+    int upgrade = 0;
+    int add_www = 0;
+    int strip_www = 0;
+    int add_slash = 0;
+  };
+
+  /* scheme://host[:port]path[?query], anything after the path kept in rest */
+  struct url {
+    std::string scheme, host, port, path, rest;
+
+    bool parse(const std::string &u) {
+      size_t p = u.find("://");
+      if (p == std::string::npos)
+        return false;
+      scheme = u.substr(0, p);
+      size_t start = p + 3;
+      size_t path_pos = u.find_first_of("/?#", start);
+      std::string authority = u.substr(start, path_pos - start);
+      if (authority.empty() || authority.find('@') != std::string::npos)
+        return false;
+      size_t colon = authority.rfind(':');
+      host = authority.substr(0, colon);
+      port = colon == std::string::npos ? "" : authority.substr(colon);
+      path.clear();
+      rest.clear();
+      if (path_pos == std::string::npos)
+        return true;
+      size_t rest_pos = u.find_first_of("?#", path_pos);
+      path = u.substr(path_pos, rest_pos - path_pos);
+      if (rest_pos != std::string::npos)
+        rest = u.substr(rest_pos);
+      return true;
+    }
+
+    std::string origin() const { return scheme + "://" + host + port; }
+    std::string str() const { return origin() + path + rest; }
+  };
+
+  /* directory-like path that servers commonly redirect to add a slash */
+  static bool slash_candidate(const url &a) {
+    if (a.path.empty() || a.path.back() == '/' || !a.rest.empty())
+      return false;
+    return a.path.find('.', a.path.rfind('/')) == std::string::npos;
+  }
+
+  /* returns true when the rule becomes active */
+  bool learn(int &count) {
+    if (count == disabled)
+      return false;
+    return ++count == threshold_;
+  }
+
+  /*
+   * Apply the active rules to a, disabling each one used if `disable`.
+   * Rules of the rewritten origin apply in turn, e.g. upgrade then slash.
+   */
+  bool apply(url &a, bool disable) {
+    std::string before = a.str();
+    for (int pass = 0; pass < 3; pass++) {
+      auto p = rules_.find(a.origin());
+      if (p == rules_.end())
+        break;
+      host_rules &r = p->second;
+      std::string origin = a.origin();
+      if (active(r.upgrade) && a.scheme == "http") {
+        a.scheme = "https";
+        used(r.upgrade, disable);
+      }
+      if (active(r.add_www) && a.host.compare(0, 4, "www.")) {
+        a.host = "www." + a.host;
+        used(r.add_www, disable);
+      }
+      if (active(r.strip_www) && !a.host.compare(0, 4, "www.")) {
+        a.host = a.host.substr(4);
+        used(r.strip_www, disable);
+      }
+      if (active(r.add_slash) && slash_candidate(a)) {
+        a.path += "/";
+        used(r.add_slash, disable);
+      }
+      if (a.origin() == origin)
+        break;
+    }
+    return a.str() != before;
+  }
+
+  void used(int &count, bool disable) {
+    if (disable)
+      count = disabled;
+  }
+
+  bool active(int count) const { return count >= threshold_; }
+
+  int threshold_;
+  int saved_;
+  std::map<std::string, host_rules> rules_;
+};
+
+#endif
+// REWRITE_RULES_H_
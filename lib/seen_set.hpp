@@ -0,0 +1,60 @@
+/*
+ * Concurrent set of URLs seen so far.
+ *
+ * URLs are kept as 64-bit fingerprints in lock-striped shards: the low bits
+ * of the fingerprint pick a shard, each with its own mutex, so threads only
+ * contend when they touch the same shard at the same time. With 64 shards
+ * and a handful of parser threads that is rare.
+ */
+
+#ifndef SEEN_SET_H_
+#define SEEN_SET_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#include "fingerprint.hpp"
+
+class seen_set {
+public:
+  static const int n_shards = 64;
+
+  /* true if url was not in the set; it is in the set afterwards */
+  bool test_and_insert(const std::string &url) {
+    uint64_t fp = fingerprint(url);
+    shard &s = shards_[fp % n_shards];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.fps.insert(fp).second;
+  }
+
+  bool contains(const std::string &url) {
+    uint64_t fp = fingerprint(url);
+    shard &s = shards_[fp % n_shards];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.fps.count(fp) > 0;
+  }
+
+  size_t size() {
+    size_t n = 0;
+    for (auto &s : shards_) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      n += s.fps.size();
+    }
+    return n;
+  }
+
+private:
+  /* padded so neighbouring shard locks don't share a cache line */
+  struct shard {
+    std::mutex mutex;
+    std::unordered_set<uint64_t> fps;
+    char pad[64];
+  };
+
+  shard shards_[n_shards];
+};
+
+#endif
+// SEEN_SET_H_
@@ -0,0 +1,136 @@
+/*
+ * URL seen-set shared between processes through a memory-mapped file.
+ *
+ * The file holds a fixed size open addressing table of 64-bit URL
+ * fingerprints after a small header. Every process that maps it inserts
+ * with a compare-and-swap on the slot, so the first process to claim a
+ * URL wins and the others see it as taken, without any locking. Slots are
+ * never removed one by one; the header records when the table was started,
+ * and the first process to open it after `ttl` seconds clears it.
+ */
+
+#ifndef SHARED_SEEN_H_
+#define SHARED_SEEN_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fingerprint.hpp"
+
+class shared_seen {
+public:
+  shared_seen() : map_(nullptr), size_(0), slots_(nullptr), capacity_(0) {}
+
+  ~shared_seen() {
+    if (map_)
+      munmap(map_, size_);
+  }
+
+  /*
+   * map path, creating a table of `capacity` slots if it doesn't exist and
+   * clearing it if it was started more than `ttl` seconds ago
+   */
+  bool open(const std::string &path, long ttl = 86400,
+            uint64_t capacity = 1 << 20) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+      return false;
+    /* only one process formats or clears the file */
+    flock(fd, LOCK_EX);
+    header h;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    bool expired = false;
+    if (ok && st.st_size == 0) {
+      uint64_t n = 1;
+      while (n < capacity)
+        n *= 2;
+      std::memcpy(h.magic, magic(), 8);
+      h.capacity = n;
+      h.started_at = std::time(nullptr);
+      ok = ftruncate(fd, sizeof h + n * sizeof(uint64_t)) == 0 &&
+           pwrite(fd, &h, sizeof h, 0) == sizeof h;
+    } else if (ok) {
+      ok = pread(fd, &h, sizeof h, 0) == sizeof h &&
+           !std::memcmp(h.magic, magic(), 8) &&
+           st.st_size >= (off_t)(sizeof h + h.capacity * sizeof(uint64_t));
+      expired = ok && std::time(nullptr) - h.started_at > ttl;
+    }
+
+    void *map = MAP_FAILED;
+    if (ok) {
+      size_ = sizeof h + h.capacity * sizeof(uint64_t);
+      map = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map != MAP_FAILED && expired) {
+      /* processes still mapping the old table just see it emptied */
+      auto *slots = reinterpret_cast<std::atomic<uint64_t> *>((char *)map + sizeof h);
+      for (uint64_t i = 0; i < h.capacity; i++)
+        slots[i].store(0, std::memory_order_relaxed);
+      h.started_at = std::time(nullptr);
+      ok = pwrite(fd, &h, sizeof h, 0) == sizeof h;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (map == MAP_FAILED)
+      return false;
+    if (!ok) {
+      munmap(map, size_);
+      return false;
+    }
+    map_ = map;
+    capacity_ = h.capacity;
+    slots_ = reinterpret_cast<std::atomic<uint64_t> *>((char *)map + sizeof h);
+    return true;
+  }
+
+  bool is_open() const { return map_ != nullptr; }
+
+  /*
+   * true if no process has claimed url yet; it is claimed afterwards. A
+   * table too full to place it answers true, so the URL is still checked.
+   */
+  bool test_and_insert(const std::string &url) {
+    uint64_t fp = fingerprint(url);
+    if (fp == 0)
+      fp = 1; /* 0 marks an empty slot */
+    for (uint64_t i = 0; i < max_probes && i < capacity_; i++) {
+      std::atomic<uint64_t> &slot = slots_[(fp + i) & (capacity_ - 1)];
+      uint64_t current = slot.load(std::memory_order_acquire);
+      if (current == 0 &&
+          slot.compare_exchange_strong(current, fp, std::memory_order_acq_rel))
+        return true;
+      if (current == fp)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  static const uint64_t max_probes = 64;
+
+  struct header {
+    char magic[8];
+    uint64_t capacity;
+    int64_t started_at;
+  };
+
+  static const char *magic() { return "CRWLSEEN"; }
+
+  void *map_;
+  size_t size_;
+  std::atomic<uint64_t> *slots_;
+  uint64_t capacity_;
+};
+
+#endif
+// SHARED_SEEN_H_
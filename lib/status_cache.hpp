@@ -0,0 +1,138 @@
+/*
+ * Persistent link status cache shared between runs and processes.
+ *
+ * Maps a URL fingerprint to the last HTTP status seen for it and when it
+ * was checked. The file is a flat array of fixed size records after a
+ * magic header. Readers and writers serialize on an flock()ed companion
+ * lock file; save() merges what is on disk with what this process learned,
+ * keeping the newer record for each URL, so concurrent crawls never drop
+ * each other's results.
+ */
+
+#ifndef STATUS_CACHE_H_
+#define STATUS_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "fingerprint.hpp"
+
+class status_cache {
+public:
+  struct record {
+    uint64_t fp;
+    int32_t status;
+    int32_t reserved;
+    int64_t checked_at;
+  };
+
+  explicit status_cache(long ttl = 86400) : ttl_(ttl) {}
+
+  void set_ttl(long ttl) { ttl_ = ttl; }
+
+  /* add what is on disk, keeping the newer record for URLs known here */
+  bool load(const std::string &path) {
+    int lock = lock_file(path, LOCK_SH);
+    if (lock < 0)
+      return false;
+    std::unordered_map<uint64_t, record> stored;
+    read_records(path, stored);
+    unlock_file(lock);
+    for (const auto &r : stored) {
+      auto p = records_.find(r.first);
+      if (p == records_.end() || p->second.checked_at < r.second.checked_at)
+        records_[r.first] = r.second;
+    }
+    return true;
+  }
+
+  bool save(const std::string &path) {
+    int lock = lock_file(path, LOCK_EX);
+    if (lock < 0)
+      return false;
+    /* keep whatever other processes stored since we loaded */
+    std::unordered_map<uint64_t, record> merged;
+    read_records(path, merged);
+    for (const auto &r : records_) {
+      auto p = merged.find(r.first);
+      if (p == merged.end() || p->second.checked_at < r.second.checked_at)
+        merged[r.first] = r.second;
+    }
+    bool ok = write_records(path, merged);
+    unlock_file(lock);
+    return ok;
+  }
+
+  /* status of url if checked within the ttl, else -1 */
+  int lookup(const std::string &url) const {
+    auto p = records_.find(fingerprint(url));
+    if (p == records_.end() || std::time(nullptr) - p->second.checked_at > ttl_)
+      return -1;
+    return p->second.status;
+  }
+
+  void store(const std::string &url, int status) {
+    record r = {fingerprint(url), status, 0, (int64_t)std::time(nullptr)};
+    records_[r.fp] = r;
+  }
+
+  size_t size() const { return records_.size(); }
+
+private:
+  static const char *magic() { return "CRWLST01"; }
+
+  static int lock_file(const std::string &path, int op) {
+    int fd = open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd >= 0 && flock(fd, op) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static void unlock_file(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+
+  static void read_records(const std::string &path,
+                           std::unordered_map<uint64_t, record> &out) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if (!f)
+      return;
+    char header[8];
+    if (std::fread(header, 1, 8, f) == 8 && !std::memcmp(header, magic(), 8)) {
+      record r;
+      while (std::fread(&r, sizeof r, 1, f) == 1)
+        out[r.fp] = r;
+    }
+    std::fclose(f);
+  }
+
+  static bool write_records(const std::string &path,
+                            const std::unordered_map<uint64_t, record> &in) {
+    std::string tmp = path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f)
+      return false;
+    bool ok = std::fwrite(magic(), 1, 8, f) == 8;
+    for (const auto &r : in)
+      ok = ok && std::fwrite(&r.second, sizeof r.second, 1, f) == 1;
+    ok = std::fclose(f) == 0 && ok;
+    return ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+  long ttl_;
+  std::unordered_map<uint64_t, record> records_;
+};
+
+#endif
+// STATUS_CACHE_H_
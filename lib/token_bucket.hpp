@@ -0,0 +1,77 @@
+/*
+ * Token bucket rate limiter.
+ *
+ * Tokens refill continuously at `rate` per second up to `burst`. A rate of
+ * 0 means unlimited. take() may drive the bucket into debt, which is how
+ * byte budgets are charged after the fact when the size of a transfer is
+ * only known once it completes.
+ */
+
+#ifndef TOKEN_BUCKET_H_
+#define TOKEN_BUCKET_H_
+
+#include <algorithm>
+#include <chrono>
+
+class token_bucket {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  explicit token_bucket(double rate = 0, double burst = 0) {
+    configure(rate, burst);
+  }
+
+  /* burst defaults to one second worth of tokens */
+  void configure(double rate, double burst = 0) {
+    rate_ = rate;
+    burst_ = burst > 0 ? burst : std::max(1.0, rate);
+    tokens_ = burst_;
+    last_ = clock::now();
+  }
+
+  bool unlimited() const { return rate_ <= 0; }
+  double rate() const { return rate_; }
+
+  /* take n tokens if available */
+  bool try_take(double n = 1) {
+    if (unlimited())
+      return true;
+    refill();
+    if (tokens_ < n)
+      return false;
+    tokens_ -= n;
+    return true;
+  }
+
+  /* take n tokens unconditionally, possibly going into debt */
+  void take(double n) {
+    if (unlimited())
+      return;
+    refill();
+    tokens_ -= n;
+  }
+
+  /* seconds until n tokens are available */
+  double wait_time(double n = 1) {
+    if (unlimited())
+      return 0;
+    refill();
+    return tokens_ >= n ? 0 : (n - tokens_) / rate_;
+  }
+
+private:
+  void refill() {
+    clock::time_point now = clock::now();
+    std::chrono::duration<double> dt = now - last_;
+    last_ = now;
+    tokens_ = std::min(burst_, tokens_ + dt.count() * rate_);
+  }
+
+  double rate_;
+  double burst_;
+  double tokens_;
+  clock::time_point last_;
+};
+
+#endif
+// TOKEN_BUCKET_H_
@@ -0,0 +1,171 @@
+/*
+ * Crawler trap detection.
+ *
+ * URLs are reduced to a per-host pattern: path segments that look like
+ * numbers, dates or ids become placeholders and query values are dropped,
+ * keeping only the sorted parameter names. Once a pattern has been admitted
+ * `threshold` times, further URLs matching it are suppressed. The same cap
+ * applies to the number of distinct query strings seen on one templated
+ * path, and URLs whose path repeats a component more than `max_repeat`
+ * times (e.g. /a/b/a/b/a/b) are suppressed outright.
+ */
+
+#ifndef TRAP_DETECTOR_H_
+#define TRAP_DETECTOR_H_
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class trap_detector {
+public:
+  explicit trap_detector(int threshold = 100, int max_repeat = 3)
+      : threshold_(threshold), max_repeat_(max_repeat) {}
+
+  void set_threshold(int threshold) { threshold_ = threshold; }
+
+  /* record url, returns false if it should not be fetched */
+  bool admit(const std::string &url) {
+    if (threshold_ <= 0)
+      return true;
+
+    std::string origin, path, query;
+    split(url, origin, path, query);
+
+    std::vector<std::string> segments;
+    std::string templ = origin;
+    size_t pos = 0;
+    while (pos < path.size()) {
+      size_t end = path.find('/', pos + 1);
+      if (end == std::string::npos)
+        end = path.size();
+      std::string seg = path.substr(pos + 1, end - pos - 1);
+      segments.push_back(seg);
+      templ += '/';
+      templ += placeholder(seg);
+      pos = end;
+    }
+
+    std::map<std::string, int> repeats;
+    for (const auto &seg : segments) {
+      if (!seg.empty() && ++repeats[seg] > max_repeat_)
+        return suppress(templ + " (repeating path component)");
+    }
+
+    if (!query.empty()) {
+      std::set<std::string> &variants = queries_[templ];
+      if (!variants.count(query) && (int)variants.size() >= threshold_)
+        return suppress(templ + "?* (query permutations)");
+      variants.insert(query);
+      templ += '?';
+      templ += param_names(query);
+    }
+
+    if (++counts_[templ] > threshold_)
+      return suppress(templ);
+    return true;
+  }
+
+  /* suppressed pattern -> number of URLs not fetched */
+  const std::map<std::string, int> &suppressed() const { return suppressed_; }
+
+  /* tab separated "<kind> <count or query> <pattern>" lines */
+  void save(std::ostream &s) const {
+    for (const auto &c : counts_)
+      s << "c\t" << c.second << "\t" << c.first << "\n";
+    for (const auto &q : queries_)
+      for (const auto &query : q.second)
+        s << "q\t" << query << "\t" << q.first << "\n";
+    for (const auto &c : suppressed_)
+      s << "s\t" << c.second << "\t" << c.first << "\n";
+  }
+
+  void load(std::istream &s) {
+    std::string kind, value, pattern;
+    while (std::getline(s, kind, '\t') && std::getline(s, value, '\t') &&
+           std::getline(s, pattern)) {
+      if (kind == "c")
+        counts_[pattern] = std::stoi(value);
+      else if (kind == "q")
+        queries_[pattern].insert(value);
+      else if (kind == "s")
+        suppressed_[pattern] = std::stoi(value);
+    }
+  }
+
+private:
+  bool suppress(const std::string &pattern) {
+    suppressed_[pattern]++;
+    return false;
+  }
+
+  static void split(const std::string &url, std::string &origin,
+                    std::string &path, std::string &query) {
+    size_t p = url.find("://");
+    size_t start = p == std::string::npos ? 0 : p + 3;
+    size_t path_pos = url.find_first_of("/?#", start);
+    origin = url.substr(0, path_pos);
+    if (path_pos == std::string::npos)
+      return;
+    size_t query_pos = url.find('?', path_pos);
+    size_t frag_pos = url.find('#', path_pos);
+    path = url.substr(path_pos, std::min(query_pos, frag_pos) - path_pos);
+    if (query_pos != std::string::npos && query_pos < frag_pos)
+      query = url.substr(query_pos + 1, frag_pos == std::string::npos
+                                            ? std::string::npos
+                                            : frag_pos - query_pos - 1);
+  }
+
+  /* {n} for numbers and dates, {id} for session ids, hashes and uuids */
+  static std::string placeholder(const std::string &seg) {
+    size_t dot = seg.rfind('.');
+    if (dot != std::string::npos && dot > 0 && seg.size() - dot <= 5)
+      return placeholder(seg.substr(0, dot)) + seg.substr(dot);
+
+    size_t digits = 0, alnum = 0, token = 0;
+    for (char c : seg) {
+      if (isdigit((unsigned char)c))
+        digits++;
+      if (isalnum((unsigned char)c))
+        alnum++;
+      if (isalnum((unsigned char)c) || c == '-' || c == '_')
+        token++;
+    }
+    if (digits && digits + (seg.size() - alnum) == seg.size())
+      return "{n}";
+    if (digits && seg.size() >= 16 && token == seg.size())
+      return "{id}";
+    return seg;
+  }
+
+  static std::string param_names(const std::string &query) {
+    std::vector<std::string> names;
+    size_t pos = 0;
+    while (pos <= query.size()) {
+      size_t end = query.find('&', pos);
+      if (end == std::string::npos)
+        end = query.size();
+      std::string param = query.substr(pos, end - pos);
+      names.push_back(param.substr(0, param.find('=')));
+      pos = end + 1;
+    }
+    std::sort(names.begin(), names.end());
+    std::string out;
+    for (const auto &n : names)
+      out += (out.empty() ? "" : "&") + n;
+    return out;
+  }
+
+  int threshold_;
+  int max_repeat_;
+  std::map<std::string, int> counts_;
+  std::map<std::string, std::set<std::string> > queries_;
+  std::map<std::string, int> suppressed_;
+};
+
+#endif
+// TRAP_DETECTOR_H_
@@ -0,0 +1,124 @@
+/*
+ * Thread pool with per-worker task deques and work stealing.
+ *
+ * Tasks are dealt round-robin to the workers' deques. A worker runs its own
+ * tasks newest first and, once its deque is empty, steals the oldest task
+ * of another worker, so a few huge pages queued behind one worker do not
+ * hold up the small ones queued behind it.
+ */
+
+#ifndef WORK_STEALING_POOL_H_
+#define WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class work_stealing_pool {
+public:
+  typedef std::function<void()> task;
+
+  work_stealing_pool() : n_(0), stop_(false), queued_(0), next_(0), steals_(0) {}
+
+  ~work_stealing_pool() { stop(); }
+
+  /* a stopped pool may be started again */
+  void start(int n_threads) {
+    n_ = n_threads;
+    stop_ = false;
+    queued_ = 0;
+    next_ = 0;
+    queues_.reset(new queue[n_]);
+    for (int i = 0; i < n_; i++)
+      workers_.emplace_back([this, i] { run(i); });
+  }
+
+  /* finish all submitted tasks, then join the workers */
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    for (auto &w : workers_)
+      w.join();
+    workers_.clear();
+  }
+
+  int threads() const { return (int)workers_.size(); }
+  size_t steals() const { return steals_; }
+
+  void submit(task t) {
+    queue &q = queues_[next_++ % n_];
+    {
+      std::lock_guard<std::mutex> lock(q.mutex);
+      q.tasks.push_back(std::move(t));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_++;
+    }
+    cond_.notify_one();
+  }
+
+private:
+  struct queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  /* own deque from the back, then steal from the front of the others */
+  bool take(int self, task &t) {
+    for (int k = 0; k < n_; k++) {
+      queue &q = queues_[(self + k) % n_];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty())
+        continue;
+      if (k == 0) {
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        t = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        steals_++;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void run(int self) {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (queued_ == 0)
+          return;
+        /* claim one task; it is already in some deque */
+        queued_--;
+      }
+      task t;
+      while (!take(self, t))
+        std::this_thread::yield();
+      t();
+    }
+  }
+
+  int n_;
+  std::unique_ptr<queue[]> queues_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_;
+  size_t queued_;
+  size_t next_;
+  std::atomic<size_t> steals_;
+};
+
+#endif
+// WORK_STEALING_POOL_H_
@@ -0,0 +1,23 @@
+/*
+ * Shard side of `crawl --shards`, for crawl(1) rather than for embedders.
+ *
+ * The parent forks one process per shard, and each calls crawl_as_shard()
+ * before creating its crawler. That crawler then only fetches the hosts
+ * its shard owns, routes links to other hosts through the parent over
+ * router_fd and sends its results there, see crawler.cpp.
+ */
+
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <cstddef>
+#include <string>
+
+/* shard that crawls the host of url, with n_shards processes */
+size_t shard_of(const std::string &url, int n_shards);
+
+/* crawlers created from now on in this process are shard_id of n_shards */
+void crawl_as_shard(int n_shards, int shard_id, int router_fd);
+
+#endif
+// SHARD_H_
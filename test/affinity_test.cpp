@@ -0,0 +1,59 @@
+/* Warm-host preference when admitting transfers, see lib/affinity.hpp */
+
+#include <deque>
+#include <set>
+#include <string>
+
+#include "affinity.hpp"
+#include "check.hpp"
+
+using std::string;
+
+std::set<string> warm_hosts;
+
+bool warm(const string &url) {
+  return warm_hosts.count(url.substr(0, url.find('/'))) > 0;
+}
+
+int main() {
+  std::deque<string> queue = {"cold/1", "cold/2", "warm/1", "cold/3", "warm/2"};
+  size_t skips = 0;
+
+  /* nothing warm: the head */
+  CHECK(pick_warm(queue, 32, skips, warm) == 0);
+  CHECK(skips == 0);
+
+  /* the first warm URL within the window, passing over the head */
+  warm_hosts.insert("warm");
+  CHECK(pick_warm(queue, 32, skips, warm) == 2);
+  CHECK(skips == 1);
+
+  /* a warm URL beyond the window is not looked for */
+  CHECK(pick_warm(queue, 2, skips, warm) == 0);
+  CHECK(skips == 0);
+
+  /* a warm head resets the count */
+  std::deque<string> warm_head = {"warm/1", "cold/1"};
+  skips = 5;
+  CHECK(pick_warm(warm_head, 32, skips, warm) == 0);
+  CHECK(skips == 0);
+
+  /* cold hosts don't starve: the head is taken after `window` skips */
+  std::deque<string> busy = {"cold/1", "cold/2", "cold/3"};
+  for (int i = 0; i < 100; i++)
+    busy.push_back("warm/" + std::to_string(i));
+  size_t window = 8;
+  skips = 0;
+  for (int cold = 1; cold <= 3; cold++) {
+    for (size_t k = 0; k < window; k++) {
+      size_t i = pick_warm(busy, window, skips, warm);
+      CHECK(busy[i].compare(0, 5, "warm/") == 0);
+      busy.erase(busy.begin() + i);
+    }
+    CHECK(pick_warm(busy, window, skips, warm) == 0);
+    CHECK(busy.front() == "cold/" + std::to_string(cold));
+    CHECK(skips == 0);
+    busy.pop_front();
+  }
+  return check_result();
+}
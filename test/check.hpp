@@ -0,0 +1,26 @@
+/*
+ * Minimal checks for the unit tests under test/, run by ctest. A failed
+ * CHECK prints its location and makes the test exit non-zero; unlike
+ * assert() it stays on in release builds.
+ */
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <cstdio>
+
+static int check_failures = 0;
+
+#define CHECK(cond)                                                           \
+  do {                                                                        \
+    if (!(cond)) {                                                            \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      check_failures++;                                                       \
+    }                                                                         \
+  } while (0)
+
+/* exit status of a test's main() */
+static inline int check_result() { return check_failures ? 1 : 0; }
+
+#endif
+// CHECK_H_
@@ -0,0 +1,55 @@
+/* Latency quantiles and the timeouts derived from them, see lib/latency_histogram.hpp */
+
+#include <cmath>
+
+#include "check.hpp"
+#include "latency_histogram.hpp"
+
+bool near(double a, double b) { return std::fabs(a - b) <= 1e-9; }
+
+int main() {
+  latency_histogram h;
+  CHECK(h.samples() == 0);
+
+  /* the fixed timeout until there are enough samples to go by */
+  for (int i = 0; i < latency_histogram::min_samples - 1; i++)
+    h.add(0.1);
+  CHECK(h.timeout_ms(3, 5000, 1000, 30000) == 5000);
+
+  /* then p99 times the factor: 0.1s falls in the bucket up to 1.25^21 ms */
+  h.add(0.1);
+  double p99 = std::pow(1.25, 21) / 1000;
+  CHECK(near(h.quantile(0.99), p99));
+  CHECK(h.timeout_ms(3, 5000, 100, 30000) == (long)(p99 * 3 * 1000));
+
+  /* clamped to the range */
+  CHECK(h.timeout_ms(3, 5000, 1000, 30000) == 1000);
+  CHECK(h.timeout_ms(1000, 5000, 1000, 30000) == 30000);
+
+  /* factor 0 means fixed timeouts */
+  CHECK(h.timeout_ms(0, 5000, 1000, 30000) == 5000);
+
+  /* a slow tail moves p99 but not the median */
+  latency_histogram mixed;
+  for (int i = 0; i < 95; i++)
+    mixed.add(0.01);
+  for (int i = 0; i < 5; i++)
+    mixed.add(2);
+  CHECK(mixed.quantile(0.5) < 0.013);
+  CHECK(mixed.quantile(0.99) >= 2 && mixed.quantile(0.99) < 2.5);
+  CHECK(mixed.timeout_ms(3, 5000, 1000, 30000) > 6000);
+
+  /* samples beyond the last bucket count towards it */
+  latency_histogram slow;
+  for (int i = 0; i < 10; i++)
+    slow.add(600);
+  CHECK(near(slow.quantile(0.99), std::pow(1.25, latency_histogram::n_buckets - 1) / 1000));
+  CHECK(slow.timeout_ms(3, 5000, 1000, 30000) == 30000);
+
+  /* old samples decay */
+  latency_histogram decay;
+  for (int i = 0; i < latency_histogram::max_samples; i++)
+    decay.add(0.01);
+  CHECK(decay.samples() == latency_histogram::max_samples / 2);
+  return check_result();
+}
@@ -0,0 +1,79 @@
+/* Page cache and its change-rate estimate, see lib/page_cache.hpp */
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "check.hpp"
+#include "page_cache.hpp"
+
+using std::string;
+
+page_entry page(uint64_t hash) {
+  page_entry e;
+  e.hash = hash;
+  e.links = {"http://a/x", "http://a/y"};
+  return e;
+}
+
+int main() {
+  const long day = 86400;
+  page_cache c;
+
+  /* unknown until fetched twice */
+  CHECK(!c.update("http://a/", page(1), 1000));
+  CHECK(c.find("http://a/")->change_rate() == -1);
+  CHECK(c.find("http://a/")->staleness(1000 + day) == 1);
+
+  /* a change is detected by the hash */
+  CHECK(c.update("http://a/", page(2), 1000 + day));
+  CHECK(!c.update("http://a/", page(2), 1000 + 2 * day));
+  const page_entry *e = c.find("http://a/");
+  CHECK(e->intervals == 2 && e->changes == 1 && e->observed == 2 * day);
+  double rate = e->change_rate();
+  CHECK(std::fabs(rate - -std::log(1.5 / 2.5) / day) < 1e-12);
+
+  /* staleness grows with the time since the last fetch */
+  CHECK(e->staleness(e->fetched_at) == 0);
+  CHECK(e->staleness(e->fetched_at + day) < e->staleness(e->fetched_at + 7 * day));
+  CHECK(std::fabs(e->staleness(e->fetched_at + day) - (1 - std::exp(-rate * day))) < 1e-12);
+
+  /* a revalidation is an unchanged interval */
+  c.revalidated("http://a/", 1000 + 3 * day);
+  CHECK(c.find("http://a/")->intervals == 3);
+  CHECK(c.find("http://a/")->change_rate() < rate);
+
+  /* a page changing at every fetch doesn't saturate, more evidence raises it */
+  page_cache always;
+  for (int i = 0; i <= 2; i++)
+    always.update("http://b/", page(i + 1), 1000 + i * day);
+  double two = always.find("http://b/")->change_rate();
+  for (int i = 3; i <= 10; i++)
+    always.update("http://b/", page(i + 1), 1000 + i * day);
+  double ten = always.find("http://b/")->change_rate();
+  CHECK(std::isfinite(two) && std::isfinite(ten));
+  CHECK(ten > two);
+
+  /* without hashes, by the validators */
+  page_cache v;
+  page_entry tagged;
+  tagged.etag = "\"1\"";
+  v.update("http://c/", tagged, 1000);
+  CHECK(!v.update("http://c/", tagged, 2000));
+  tagged.etag = "\"2\"";
+  CHECK(v.update("http://c/", tagged, 3000));
+
+  /* history, validators and links survive a save and load */
+  string path = "page_cache_test.tmp";
+  CHECK(c.save(path));
+  page_cache loaded;
+  CHECK(loaded.load(path));
+  std::remove(path.c_str());
+  CHECK(loaded.size() == 1);
+  const page_entry *l = loaded.find("http://a/");
+  CHECK(l && l->hash == 2 && l->last_modified == -1 && l->etag.empty());
+  CHECK(l && l->links == c.find("http://a/")->links);
+  CHECK(l && l->change_rate() == c.find("http://a/")->change_rate());
+  CHECK(l && l->fetched_at == 1000 + 3 * day);
+  return check_result();
+}
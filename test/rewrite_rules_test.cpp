@@ -0,0 +1,67 @@
+/* Redirect rules learned from observed redirects, see lib/rewrite_rules.hpp */
+
+#include <string>
+
+#include "check.hpp"
+#include "rewrite_rules.hpp"
+
+using std::string;
+
+int main() {
+  /* a rule becomes active at the threshold, and says so once */
+  rewrite_rules r(3);
+  CHECK(!r.observe_redirect("http://a.com/1", "https://a.com/1"));
+  CHECK(!r.observe_redirect("http://a.com/2", "https://a.com/2"));
+  CHECK(r.rewrite("http://a.com/3") == "http://a.com/3");
+  CHECK(r.observe_redirect("http://a.com/3", "https://a.com/3"));
+  CHECK(!r.observe_redirect("http://a.com/4", "https://a.com/4"));
+
+  CHECK(r.rewrite("http://a.com/5?q=1") == "https://a.com/5?q=1");
+  CHECK(r.saved() == 1);
+  CHECK(r.rewrite("https://a.com/5") == "https://a.com/5");
+  CHECK(r.rewrite("http://b.com/5") == "http://b.com/5");
+  CHECK(r.saved() == 1);
+
+  /* a failed fetch of a rewrite disables the rule and takes back the saving */
+  r.reject("http://a.com/5?q=1");
+  CHECK(r.saved() == 0);
+  CHECK(r.rewrite("http://a.com/6") == "http://a.com/6");
+
+  /* so does a page the rule would have redirected */
+  rewrite_rules f(2);
+  f.observe_redirect("http://a.com/1", "https://a.com/1");
+  f.observe_redirect("http://a.com/2", "https://a.com/2");
+  f.observe_final("http://a.com/3");
+  CHECK(f.rewrite("http://a.com/4") == "http://a.com/4");
+  CHECK(!f.observe_redirect("http://a.com/5", "https://a.com/5"));
+
+  /* redirects no rule explains are not learned from */
+  rewrite_rules n(1);
+  CHECK(!n.observe_redirect("http://a.com/1", "https://b.com/1"));
+  CHECK(!n.observe_redirect("http://a.com/1", "http://a.com/2"));
+  CHECK(!n.observe_redirect("http://a.com/1", "http://a.com:8080/1"));
+  CHECK(n.rewrite("http://a.com/1") == "http://a.com/1");
+
+  /* rules of the rewritten origin apply in turn: upgrade, www, slash */
+  rewrite_rules c(1);
+  CHECK(c.observe_redirect("http://a.com/x", "https://a.com/x"));
+  CHECK(c.observe_redirect("https://a.com/x", "https://www.a.com/x"));
+  CHECK(c.observe_redirect("https://www.a.com/dir", "https://www.a.com/dir/"));
+  CHECK(c.rewrite("http://a.com/docs") == "https://www.a.com/docs/");
+  CHECK(c.rewrite("http://a.com/page.html") == "https://www.a.com/page.html");
+  CHECK(c.saved() == 2);
+
+  /* rejecting the chain disables every rule it used */
+  c.reject("http://a.com/docs");
+  CHECK(c.rewrite("http://a.com/other") == "http://a.com/other");
+  CHECK(c.rewrite("https://a.com/y") == "https://a.com/y");
+  CHECK(c.rewrite("https://www.a.com/y") == "https://www.a.com/y");
+
+  /* threshold 0 turns learning off */
+  rewrite_rules off(0);
+  for (int i = 0; i < 10; i++)
+    CHECK(!off.observe_redirect("http://a.com/" + std::to_string(i),
+                                "https://a.com/" + std::to_string(i)));
+  CHECK(off.rewrite("http://a.com/1") == "http://a.com/1");
+  return check_result();
+}
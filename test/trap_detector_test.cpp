@@ -0,0 +1,61 @@
+/* Crawler trap detection, see lib/trap_detector.hpp */
+
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "trap_detector.hpp"
+
+using std::string;
+
+int main() {
+  /* numbered pages share a pattern, capped at the threshold */
+  trap_detector t(3);
+  for (int i = 0; i < 3; i++)
+    CHECK(t.admit("http://a/cal/2024-01-0" + std::to_string(i + 1)));
+  CHECK(!t.admit("http://a/cal/2024-01-04"));
+  CHECK(!t.admit("http://a/cal/2024-01-05"));
+  CHECK(t.suppressed().size() == 1);
+  CHECK(t.suppressed().at("http://a/cal/{n}") == 2);
+
+  /* other paths, extensions and hosts are counted apart */
+  CHECK(t.admit("http://a/about"));
+  CHECK(t.admit("http://a/cal/1.html"));
+  CHECK(t.admit("http://b/cal/2024-01-04"));
+
+  /* session ids */
+  trap_detector ids(1);
+  CHECK(ids.admit("http://a/s/0123456789abcdef0123/x"));
+  CHECK(!ids.admit("http://a/s/fedcba9876543210fedc/x"));
+  CHECK(ids.suppressed().count("http://a/s/{id}/x"));
+
+  /* a path repeating a component, whatever the threshold */
+  trap_detector loops(1000);
+  CHECK(loops.admit("http://a/x/y/x/y/x/y"));
+  CHECK(!loops.admit("http://a/x/y/x/y/x/y/x"));
+  CHECK(loops.suppressed().count("http://a/x/y/x/y/x/y/x (repeating path component)"));
+
+  /* distinct query strings on one path, in any parameter order */
+  trap_detector q(2);
+  CHECK(q.admit("http://a/list?sort=asc&page=1"));
+  CHECK(q.admit("http://a/list?page=2&sort=asc"));
+  CHECK(!q.admit("http://a/list?page=3&sort=asc"));
+  CHECK(q.admit("http://a/list"));
+  CHECK(q.suppressed().count("http://a/list?* (query permutations)"));
+
+  /* threshold 0 admits everything and counts nothing */
+  trap_detector off(0);
+  for (int i = 0; i < 1000; i++)
+    CHECK(off.admit("http://a/x/x/x/x/" + std::to_string(i)));
+  CHECK(off.suppressed().empty());
+
+  /* a resumed crawl keeps the counts */
+  std::stringstream saved;
+  t.save(saved);
+  trap_detector resumed(3);
+  resumed.load(saved);
+  CHECK(resumed.suppressed() == t.suppressed());
+  CHECK(!resumed.admit("http://a/cal/2024-01-06"));
+  CHECK(resumed.admit("http://a/about"));
+  return check_result();
+}